@@ -0,0 +1,142 @@
+#ifndef BATCH_HPP_
+#define BATCH_HPP_
+
+#include "linalgebra.hpp"
+#include "mesh.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Evaluates one refinement on many position sets (frames) that share the
+// same connectivity. The topology is refined once while its vertex rules
+// are recorded; the rules are then replayed on all frames together.
+//
+// Positions are stored frame-interleaved, vertex-major: component c of
+// vertex v in frame f lives at positions[(3*v + c)*num_frames + f]. Every
+// stencil weight is therefore applied to a contiguous run of 3*num_frames
+// floats, which the compiler vectorises.
+class FrameBatch
+{
+	public:
+		FrameBatch (size_t num_frames) : num_frames(num_frames) {}
+
+		// Refines mesh levels times, recording the rules of every level.
+		// The mesh keeps the refined connectivity, shared by all frames.
+		int refine (StandardMesh& mesh, SubdivisionScheme scheme, int levels)
+		{
+			vertex_counts.assign (1, mesh.vertices.size());
+			tables.assign (levels, StencilTable());
+			positions.assign (3*num_frames*mesh.vertices.size(), 0.f);
+
+			for (int l=0; l<levels; ++l)
+			{
+				mesh.stencil_log = &tables[l];
+				int status = mesh.subdivide (scheme);
+				mesh.stencil_log = NULL;
+				if (status != 0)
+					return -1;
+				vertex_counts.push_back (mesh.vertices.size());
+			}
+
+			return 0;
+		}
+
+		int setFrame (size_t frame, const std::vector<Vector3f>& coarse)
+		{
+			if (frame >= num_frames || coarse.size() != vertex_counts[0])
+				return -1;
+
+			for (size_t v=0; v<coarse.size(); ++v)
+				for (int c=0; c<3; ++c)
+					positions[(3*v + c)*num_frames + frame] = coarse[v][c];
+
+			return 0;
+		}
+
+		void evaluate ()
+		{
+			const size_t row = 3*num_frames;
+			std::vector<float> next;
+
+			for (size_t l=0; l<tables.size(); ++l)
+			{
+				const StencilTable& table = tables[l];
+				next.assign (row*vertex_counts[l+1], 0.f);
+				std::copy (positions.begin(), positions.end(), next.begin());
+
+				for (size_t r=0; r<table.size(); ++r)
+				{
+					float* acc = &next[table.targets[r]*row];
+					std::fill (acc, acc + row, 0.f);
+					for (int k=table.offsets[r]; k<table.offsets[r+1]; ++k)
+					{
+						const float w = table.weights[k];
+						const float* src = &positions[table.sources[k]*row];
+						for (size_t i=0; i<row; ++i)
+							acc[i] += w*src[i];
+					}
+				}
+				positions.swap (next);
+			}
+		}
+
+		// Packed xyz positions of one frame at the finest level.
+		void getFrame (size_t frame, std::vector<float>& out) const
+		{
+			size_t num_vertices = positions.size() / (3*num_frames);
+			out.resize (3*num_vertices);
+			for (size_t v=0; v<num_vertices; ++v)
+				for (int c=0; c<3; ++c)
+					out[3*v + c] = positions[(3*v + c)*num_frames + frame];
+		}
+
+		size_t numFrames () const { return num_frames; }
+		size_t numVertices () const { return vertex_counts.back(); }
+
+	private:
+		size_t num_frames;
+		std::vector<size_t> vertex_counts;
+		std::vector<StencilTable> tables;
+		std::vector<float> positions;
+};
+
+// Binary frame cache, little-endian:
+//   char[8]  "SUBDFRM1"
+//   uint32   num_vertices, num_faces, num_frames
+//   int32    indices[3*num_faces]
+//   float    positions[num_frames][num_vertices][3]
+inline int writeFrameCache (std::string path, const FrameBatch& batch, const std::vector<int>& indices)
+{
+	std::ofstream fs (path, std::ofstream::out | std::ofstream::binary);
+	if (!fs)
+	{
+		std::cout << "Output file \"" << path << "\" could not be opened." << std::endl;
+		return -1;
+	}
+
+	uint32_t header[3] = {
+		(uint32_t)batch.numVertices(),
+		(uint32_t)(indices.size() / POLY_SIZE),
+		(uint32_t)batch.numFrames()
+	};
+	fs.write ("SUBDFRM1", 8);
+	fs.write (reinterpret_cast<const char*>(header), sizeof(header));
+
+	std::vector<int32_t> idx (indices.begin(), indices.end());
+	fs.write (reinterpret_cast<const char*>(idx.data()), idx.size()*sizeof(int32_t));
+
+	std::vector<float> frame;
+	for (size_t f=0; f<batch.numFrames(); ++f)
+	{
+		batch.getFrame (f, frame);
+		fs.write (reinterpret_cast<const char*>(frame.data()), frame.size()*sizeof(float));
+	}
+
+	return fs ? 0 : -1;
+}
+
+#endif
@@ -0,0 +1,456 @@
+#ifndef BLOCKED_HPP_
+#define BLOCKED_HPP_
+
+#include "linalgebra.hpp"
+#include "mesh.hpp"
+#include "patch.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Working set of one cluster: a triangle soup with local vertex ids. Each
+// triangle remembers the control face it descends from and the barycentric
+// coordinates of its corners in that face, scaled to integers at the
+// finest level; they give every vertex its final global id.
+struct RefinementPatch
+{
+	ScratchVector<Vector3f> positions;
+	ScratchVector<int64_t> gids;
+	ScratchVector<char> valid;
+	ScratchVector<int> triangles;
+	ScratchVector<int> coarse_face;
+	ScratchVector<int> bary;
+
+	void clear ()
+	{
+		positions.clear();
+		gids.clear();
+		valid.clear();
+		triangles.clear();
+		coarse_face.clear();
+		bary.clear();
+	}
+};
+
+// Depth-first, cache-blocked Loop/butterfly refinement of a closed
+// triangle mesh.
+//
+// Control faces are grouped into clusters small enough that a cluster and
+// its halo, refined to the last level, fit the given cache size. Each
+// cluster is taken through all levels before the next one is started, so
+// only one cluster's data is in flight.
+//
+// Vertices are numbered as in ControlCage, with N = 2^levels. Rules
+// are evaluated in global-id order, so a vertex shared by two clusters is
+// computed identically by both. A vertex is only trusted when its whole
+// stencil is present and trusted; clusters whose output is not fully
+// trusted are redone with a wider halo.
+class BlockedRefiner
+{
+	public:
+		BlockedRefiner (
+				const std::vector<Vector3f>& positions,
+				const std::vector<int>& indices,
+				SubdivisionScheme scheme,
+				int levels
+		) : positions(positions), indices(indices), scheme(scheme), levels(levels), N(1 << levels),
+			cage(indices, positions.size()), num_faces(cage.num_faces), vf_offsets(cage.vf_offsets), vf_faces(cage.vf_faces)
+		{
+		}
+
+		size_t numVertices () const
+		{
+			return cage.numVertices (N);
+		}
+
+		// Writes packed xyz positions and triangle indices of the last level.
+		int run (std::vector<float>& out_positions, std::vector<int>& out_indices, size_t cache_bytes)
+		{
+			// Rough footprint of one refined triangle in a patch, including
+			// its share of vertices and of the edge tables.
+			const size_t bytes_per_face = 256;
+			size_t refined = (size_t)1 << (2*levels);
+			size_t cluster_size = std::max<size_t> (1, cache_bytes / (bytes_per_face * refined) / 4);
+
+			// Each cluster is refined together with a few rings of halo faces.
+			// Below this many faces the halo outweighs the cluster itself and
+			// the repeated work costs more than the cache misses it saves.
+			const int halo_rings = (scheme == BUTTERFLY) ? 3 : 2;
+			cluster_size = std::max<size_t> (cluster_size, 16 * halo_rings * halo_rings);
+
+			out_positions.assign (3*numVertices(), 0.f);
+			out_indices.clear();
+			out_indices.reserve (num_faces * refined * POLY_SIZE);
+
+			ScratchVector<int> cluster_of (num_faces, -1);
+			face_stamp.assign (num_faces, -1);
+			vertex_stamp.assign (positions.size(), -1);
+			vertex_local.assign (positions.size(), -1);
+			int num_clusters = 0;
+
+			ScratchVector<int> cluster;
+			for (size_t seed=0; seed<num_faces; ++seed)
+			{
+				if (cluster_of[seed] != -1) continue;
+
+				cluster.clear();
+				cluster.push_back (seed);
+				cluster_of[seed] = num_clusters;
+				for (size_t q=0; q<cluster.size() && cluster.size()<cluster_size; ++q)
+				{
+					for (int c=0; c<POLY_SIZE; ++c)
+					{
+						int v = indices[POLY_SIZE*cluster[q]+c];
+						for (int k=vf_offsets[v]; k<vf_offsets[v+1] && cluster.size()<cluster_size; ++k)
+						{
+							int f = vf_faces[k];
+							if (cluster_of[f] != -1) continue;
+							cluster_of[f] = num_clusters;
+							cluster.push_back (f);
+						}
+					}
+				}
+
+				int halo = halo_rings;
+				while (!refineCluster (cluster, cluster_of, num_clusters, halo, out_positions, out_indices))
+				{
+					if (++halo > 2*levels + 4)
+						return -1;
+				}
+				num_clusters++;
+			}
+
+			return 0;
+		}
+
+	private:
+		static uint64_t edgeKey (int a, int b)
+		{
+			return ControlCage::edgeKey (a, b);
+		}
+
+		int opposite (int a, int b) const
+		{
+			auto it = opp.find (edgeKey (a, b));
+			return (it == opp.end()) ? -1 : it->second;
+		}
+
+		bool refineCluster (
+				const ScratchVector<int>& cluster,
+				const ScratchVector<int>& cluster_of,
+				int cluster_id,
+				int halo,
+				std::vector<float>& out_positions,
+				std::vector<int>& out_indices
+		)
+		{
+			// Cluster plus 'halo' rings of vertex-adjacent faces.
+			stamp++;
+			ScratchVector<int> faces (cluster);
+			for (size_t i=0; i<faces.size(); ++i)
+				face_stamp[faces[i]] = stamp;
+			size_t ring_begin = 0;
+			for (int r=0; r<halo; ++r)
+			{
+				size_t ring_end = faces.size();
+				for (size_t q=ring_begin; q<ring_end; ++q)
+					for (int c=0; c<POLY_SIZE; ++c)
+					{
+						int v = indices[POLY_SIZE*faces[q]+c];
+						for (int k=vf_offsets[v]; k<vf_offsets[v+1]; ++k)
+						{
+							int f = vf_faces[k];
+							if (face_stamp[f] == stamp) continue;
+							face_stamp[f] = stamp;
+							faces.push_back (f);
+						}
+					}
+				ring_begin = ring_end;
+			}
+
+			current.clear();
+			for (size_t q=0; q<faces.size(); ++q)
+			{
+				const int corner_bary[6] = {N, 0, 0, N, 0, 0};
+				for (int c=0; c<POLY_SIZE; ++c)
+				{
+					int v = indices[POLY_SIZE*faces[q]+c];
+					if (vertex_stamp[v] != stamp)
+					{
+						vertex_stamp[v] = stamp;
+						vertex_local[v] = current.positions.size();
+						current.positions.push_back (positions[v]);
+						current.gids.push_back (v);
+						current.valid.push_back (1);
+					}
+					current.triangles.push_back (vertex_local[v]);
+					current.bary.push_back (corner_bary[2*c]);
+					current.bary.push_back (corner_bary[2*c+1]);
+				}
+				current.coarse_face.push_back (faces[q]);
+			}
+
+			for (int l=0; l<levels; ++l)
+			{
+				refineLevel (current, next);
+				std::swap (current, next);
+				if (l+1 < levels)
+					trim (current, cluster_of, cluster_id, 2*halo);
+			}
+
+			for (size_t t=0; t<current.coarse_face.size(); ++t)
+			{
+				if (cluster_of[current.coarse_face[t]] != cluster_id) continue;
+				for (int c=0; c<POLY_SIZE; ++c)
+					if (!current.valid[current.triangles[POLY_SIZE*t+c]])
+						return false;
+			}
+
+			for (size_t t=0; t<current.coarse_face.size(); ++t)
+			{
+				if (cluster_of[current.coarse_face[t]] != cluster_id) continue;
+				for (int c=0; c<POLY_SIZE; ++c)
+				{
+					int v = current.triangles[POLY_SIZE*t+c];
+					int64_t gid = current.gids[v];
+					out_indices.push_back (gid);
+					out_positions[3*gid] = current.positions[v][0];
+					out_positions[3*gid+1] = current.positions[v][1];
+					out_positions[3*gid+2] = current.positions[v][2];
+				}
+			}
+
+			return true;
+		}
+
+		// Drops the triangles of the halo more than 'rings' vertex rings away
+		// from the cluster's own triangles. Later levels only need a strip
+		// of constant width around the cluster, so the halo does not grow
+		// 4x per level with the rest of the patch. Vertices left with an
+		// incomplete stencil are caught by the validity tracking.
+		void trim (RefinementPatch& patch, const ScratchVector<int>& cluster_of, int cluster_id, int rings)
+		{
+			const size_t num_tris = patch.coarse_face.size();
+			const int far = rings;
+
+			distance.assign (patch.positions.size(), far);
+			for (size_t t=0; t<num_tris; ++t)
+				if (cluster_of[patch.coarse_face[t]] == cluster_id)
+					for (int c=0; c<POLY_SIZE; ++c)
+						distance[patch.triangles[3*t+c]] = 0;
+
+			for (int r=1; r<rings; ++r)
+				for (size_t t=0; t<num_tris; ++t)
+				{
+					const int* T = &patch.triangles[3*t];
+					int nearest = std::min (distance[T[0]], std::min (distance[T[1]], distance[T[2]]));
+					if (nearest != r-1) continue;
+					for (int c=0; c<POLY_SIZE; ++c)
+						distance[T[c]] = std::min (distance[T[c]], r);
+				}
+
+			remap.assign (patch.positions.size(), -1);
+			size_t kept = 0;
+			for (size_t t=0; t<num_tris; ++t)
+			{
+				const int* T = &patch.triangles[3*t];
+				if (std::min (distance[T[0]], std::min (distance[T[1]], distance[T[2]])) >= far)
+					continue;
+				for (int c=0; c<POLY_SIZE; ++c)
+				{
+					remap[T[c]] = 0;
+					patch.triangles[3*kept+c] = T[c];
+				}
+				for (int k=0; k<6; ++k)
+					patch.bary[6*kept+k] = patch.bary[6*t+k];
+				patch.coarse_face[kept] = patch.coarse_face[t];
+				kept++;
+			}
+			patch.triangles.resize (3*kept);
+			patch.bary.resize (6*kept);
+			patch.coarse_face.resize (kept);
+
+			size_t num_verts = 0;
+			for (size_t v=0; v<remap.size(); ++v)
+			{
+				if (remap[v] < 0) continue;
+				remap[v] = num_verts;
+				patch.positions[num_verts] = patch.positions[v];
+				patch.gids[num_verts] = patch.gids[v];
+				patch.valid[num_verts] = patch.valid[v];
+				num_verts++;
+			}
+			patch.positions.resize (num_verts);
+			patch.gids.resize (num_verts);
+			patch.valid.resize (num_verts);
+			for (size_t i=0; i<patch.triangles.size(); ++i)
+				patch.triangles[i] = remap[patch.triangles[i]];
+		}
+
+		void refineLevel (const RefinementPatch& in, RefinementPatch& out)
+		{
+			const size_t num_verts = in.positions.size();
+			const size_t num_tris = in.coarse_face.size();
+
+			opp.clear();
+			for (size_t t=0; t<num_tris; ++t)
+				for (int c=0; c<POLY_SIZE; ++c)
+					opp[edgeKey (in.triangles[3*t+c], in.triangles[3*t+(c+1)%3])] = in.triangles[3*t+(c+2)%3];
+
+			out.clear();
+			out.positions = in.positions;
+			out.gids = in.gids;
+			out.valid = in.valid;
+
+			if (scheme == LOOP)
+			{
+				ring_offsets.assign (num_verts + 1, 0);
+				for (size_t i=0; i<in.triangles.size(); ++i)
+					ring_offsets[in.triangles[i]+1]++;
+				for (size_t v=1; v<=num_verts; ++v)
+					ring_offsets[v] += ring_offsets[v-1];
+				ring.resize (in.triangles.size());
+				ScratchVector<int> fill (ring_offsets.begin(), ring_offsets.end()-1);
+				for (size_t t=0; t<num_tris; ++t)
+					for (int c=0; c<POLY_SIZE; ++c)
+						ring[fill[in.triangles[3*t+c]]++] = in.triangles[3*t+(c+1)%3];
+
+				for (size_t v=0; v<num_verts; ++v)
+				{
+					int* begin = &ring[0] + ring_offsets[v];
+					int* end = &ring[0] + ring_offsets[v+1];
+					bool ok = in.valid[v] != 0;
+					for (int* n=begin; ok && n!=end; ++n)
+						ok = in.valid[*n] && opposite (*n, v) != -1;
+					if (!ok)
+					{
+						out.valid[v] = 0;
+						continue;
+					}
+
+					std::sort (begin, end, [&](int a, int b){ return in.gids[a] < in.gids[b]; });
+					int n = end - begin;
+					float alpha_n = loopAlpha (n);
+
+					Vector3f sum;
+					for (int* it=begin; it!=end; ++it)
+						sum += in.positions[*it];
+					out.positions[v] = alpha_n*in.positions[v];
+					out.positions[v].addScaled ((1-alpha_n)/n, sum);
+				}
+			}
+
+			mids.clear();
+			for (size_t t=0; t<num_tris; ++t)
+				for (int c=0; c<POLY_SIZE; ++c)
+				{
+					int a = in.triangles[3*t+c];
+					int b = in.triangles[3*t+(c+1)%3];
+					if (in.gids[a] > in.gids[b]) std::swap (a, b);
+					if (!mids.insert (std::make_pair (edgeKey (a, b), (int)out.positions.size())).second)
+						continue;
+
+					out.positions.push_back (Vector3f());
+					out.gids.push_back (-1);
+					out.valid.push_back (edgePoint (in, a, b, out.positions.back()));
+				}
+
+			for (size_t t=0; t<num_tris; ++t)
+			{
+				const int* T = &in.triangles[3*t];
+				const int* B = &in.bary[6*t];
+				int m[3], mb[6];
+				for (int c=0; c<POLY_SIZE; ++c)
+				{
+					int a = T[c], b = T[(c+1)%3];
+					if (in.gids[a] > in.gids[b]) std::swap (a, b);
+					m[c] = mids[edgeKey (a, b)];
+					mb[2*c] = (B[2*c] + B[2*((c+1)%3)]) / 2;
+					mb[2*c+1] = (B[2*c+1] + B[2*((c+1)%3)+1]) / 2;
+					out.gids[m[c]] = cage.globalId (in.coarse_face[t], mb[2*c], mb[2*c+1], N);
+				}
+
+				// Corner triangles, then the centre one, as in Mesh.
+				const int children[4][3] = {{T[0], m[0], m[2]}, {m[0], T[1], m[1]}, {m[2], m[1], T[2]}, {m[0], m[1], m[2]}};
+				const int* child_bary[4][3] = {
+					{B, mb, mb+4}, {mb, B+2, mb+2}, {mb+4, mb+2, B+4}, {mb, mb+2, mb+4}
+				};
+				for (int k=0; k<4; ++k)
+				{
+					for (int c=0; c<POLY_SIZE; ++c)
+					{
+						out.triangles.push_back (children[k][c]);
+						out.bary.push_back (child_bary[k][c][0]);
+						out.bary.push_back (child_bary[k][c][1]);
+					}
+					out.coarse_face.push_back (in.coarse_face[t]);
+				}
+			}
+		}
+
+		// Point inserted on edge (a,b), a having the smaller global id.
+		// Returns false when part of the stencil is missing or untrusted.
+		bool edgePoint (const RefinementPatch& in, int a, int b, Vector3f& result) const
+		{
+			int c = opposite (a, b);
+			int d = opposite (b, a);
+			if (c < 0 || d < 0) return false;
+
+			if (scheme == LOOP)
+			{
+				if (!(in.valid[a] && in.valid[b] && in.valid[c] && in.valid[d])) return false;
+				result.addScaled (3.f/8.f, in.positions[a])
+					.addScaled (3.f/8.f, in.positions[b])
+					.addScaled (1.f/8.f, in.positions[c])
+					.addScaled (1.f/8.f, in.positions[d]);
+				return true;
+			}
+
+			int w1 = opposite (c, b), w2 = opposite (a, c), w3 = opposite (d, a), w4 = opposite (b, d);
+			if (w1 < 0 || w2 < 0 || w3 < 0 || w4 < 0) return false;
+			const int stencil[8] = {a, b, c, d, w1, w2, w3, w4};
+			for (int k=0; k<8; ++k)
+				if (!in.valid[stencil[k]]) return false;
+
+			result.addScaled (1.f/2.f, in.positions[a])
+				.addScaled (1.f/2.f, in.positions[b])
+				.addScaled (1.f/8.f, in.positions[c])
+				.addScaled (1.f/8.f, in.positions[d])
+				.addScaled (-1.f/16.f, in.positions[w1])
+				.addScaled (-1.f/16.f, in.positions[w2])
+				.addScaled (-1.f/16.f, in.positions[w3])
+				.addScaled (-1.f/16.f, in.positions[w4]);
+			return true;
+		}
+
+		const std::vector<Vector3f>& positions;
+		const std::vector<int>& indices;
+		SubdivisionScheme scheme;
+		int levels;
+		int N;
+
+		ControlCage cage;
+		size_t num_faces;
+		const ScratchVector<int>& vf_offsets;
+		const ScratchVector<int>& vf_faces;
+
+		int stamp = 0;
+		ScratchVector<int> face_stamp;
+		ScratchVector<int> vertex_stamp;
+		ScratchVector<int> vertex_local;
+
+		// Per-cluster scratch, reused so the working set stays allocated.
+		RefinementPatch current;
+		RefinementPatch next;
+		ScratchMap<uint64_t,int> opp;
+		ScratchMap<uint64_t,int> mids;
+		ScratchVector<int> ring_offsets;
+		ScratchVector<int> ring;
+		ScratchVector<int> distance;
+		ScratchVector<int> remap;
+};
+
+#endif
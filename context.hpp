@@ -0,0 +1,61 @@
+#ifndef CONTEXT_HPP_
+#define CONTEXT_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <limits>
+
+static_assert (ATOMIC_BOOL_LOCK_FREE == 2, "cancel() must be safe in a signal handler");
+
+// Deadline, cancellation and progress reporting for long-running calls.
+//
+// Work polls stopRequested() between chunks, so a stop takes effect within
+// one chunk. cancel() only stores to a lock-free atomic, so it may be
+// called from any thread, or from a signal handler.
+class ExecutionContext
+{
+	public:
+		typedef std::chrono::steady_clock Clock;
+
+		// Receives the name of the running phase and its completed fraction.
+		typedef std::function<void (const char*, double)> ProgressCallback;
+
+		ExecutionContext () : deadline(Clock::time_point::max()), cancelled(false) {}
+
+		void setDeadline (Clock::time_point t) { deadline = t; }
+
+		void setBudget (double seconds)
+		{
+			deadline = Clock::now() + std::chrono::duration_cast<Clock::duration> (std::chrono::duration<double> (seconds));
+		}
+
+		bool hasDeadline () const { return deadline != Clock::time_point::max(); }
+
+		double remainingSeconds () const
+		{
+			if (!hasDeadline())
+				return std::numeric_limits<double>::infinity();
+			return std::chrono::duration<double> (deadline - Clock::now()).count();
+		}
+
+		void cancel () { cancelled.store (true); }
+		bool isCancelled () const { return cancelled; }
+		bool expired () const { return hasDeadline() && Clock::now() >= deadline; }
+		bool stopRequested () const { return cancelled || expired(); }
+
+		void setProgressCallback (ProgressCallback callback) { progress_callback = callback; }
+
+		void progress (const char* phase, double fraction) const
+		{
+			if (progress_callback)
+				progress_callback (phase, fraction);
+		}
+
+	private:
+		Clock::time_point deadline;
+		std::atomic<bool> cancelled;
+		ProgressCallback progress_callback;
+};
+
+#endif
@@ -6,30 +6,41 @@
 #include <cassert>
 #include <cmath>
 
+// Vectors of 3 or 4 floats are padded to 16 bytes so a whole vector
+// fits in one SSE/NEON register and never straddles a cache line.
+template<typename T, size_t SIZE>
+struct VectorAlignment
+{
+	static const size_t value = (sizeof(T)*SIZE > 8) ? 16 : alignof(T);
+};
+
 template<typename T, size_t SIZE>
 class Vector
 {
 	public:
 
-		Vector()
+		constexpr Vector() : data{} {}
+
+		// Allocation-free component constructor: Vector3f v (1, 2, 3).
+		template<typename... Args>
+		constexpr Vector (T x, T y, Args... rest) : data{x, y, static_cast<T>(rest)...}
 		{
-			for (int i=0; i<SIZE; ++i)
-				this->data[i] = 0;
+			static_assert (sizeof...(Args) + 2 == SIZE, "Wrong number of components.");
 		}
 
-		Vector (std::vector<T> raw_data)
+		explicit Vector (const std::vector<T>& raw_data)
 		{
 			assert( raw_data.size() == SIZE );
-			for (int i=0; i<SIZE; ++i)
+			for (size_t i=0; i<SIZE; ++i)
 			{
 				data[i] = raw_data[i];
 			}
 		}
-		
+
 		Vector<T,SIZE> operator+ (const Vector<T,SIZE>& v) const
 		{
 			Vector<T,SIZE> result;
-			for (int i=0; i<SIZE; ++i)
+			for (size_t i=0; i<SIZE; ++i)
 				result.data[i] = this->data[i] + v.data[i];
 			return result;
 		}
@@ -37,59 +48,86 @@ class Vector
 		T operator* (const Vector<T,SIZE>& v) const
 		{
 			T result = 0;
-			for (int i=0; i<SIZE; ++i) result += v.data[i]*this->data[i];
+			for (size_t i=0; i<SIZE; ++i) result += v.data[i]*this->data[i];
 			return result;
 		}
 
 		Vector<T,SIZE> operator* (const T scalar) const
 		{
 			Vector<T,SIZE> result;
-			for (int i=0; i<SIZE; ++i)
+			for (size_t i=0; i<SIZE; ++i)
 				result.data[i] = data[i]*scalar;
 			return result;
 		}
 
-		friend Vector<T,SIZE> operator* (const T scalar, Vector<T,SIZE> v) 
+		friend Vector<T,SIZE> operator* (const T scalar, const Vector<T,SIZE>& v)
 		{
 			Vector<T,SIZE> result;
-			for (int i=0; i<SIZE; ++i)
+			for (size_t i=0; i<SIZE; ++i)
 				result.data[i] = v.data[i]*scalar;
 			return result;
 		}
 
-		Vector<T,SIZE> operator- (const Vector<T,SIZE> v) const
+		Vector<T,SIZE> operator- (const Vector<T,SIZE>& v) const
 		{
 			Vector<T,SIZE> result;
-			for (int i=0; i<SIZE; ++i)
+			for (size_t i=0; i<SIZE; ++i)
 				result.data[i] = this->data[i] - v.data[i];
 			return result;
 		}
 
+		Vector<T,SIZE>& operator+= (const Vector<T,SIZE>& v)
+		{
+			for (size_t i=0; i<SIZE; ++i) data[i] += v.data[i];
+			return *this;
+		}
+
+		Vector<T,SIZE>& operator-= (const Vector<T,SIZE>& v)
+		{
+			for (size_t i=0; i<SIZE; ++i) data[i] -= v.data[i];
+			return *this;
+		}
+
+		Vector<T,SIZE>& operator*= (const T scalar)
+		{
+			for (size_t i=0; i<SIZE; ++i) data[i] *= scalar;
+			return *this;
+		}
+
+		// Fused multiply-add: this += scalar*v, without a temporary.
+		// Stencils are accumulated with a chain of these calls.
+		Vector<T,SIZE>& addScaled (const T scalar, const Vector<T,SIZE>& v)
+		{
+			for (size_t i=0; i<SIZE; ++i) data[i] += scalar*v.data[i];
+			return *this;
+		}
+
 		T& operator[] (const size_t i) { return data[i]; }
+		constexpr const T& operator[] (const size_t i) const { return data[i]; }
 
-		friend std::ostream& operator<< (std::ostream& os, Vector<T,SIZE> v)
+		friend std::ostream& operator<< (std::ostream& os, const Vector<T,SIZE>& v)
 		{
-			for (int i=0; i<SIZE; ++i)
+			for (size_t i=0; i<SIZE; ++i)
 			{
 				os << v.data[i] << " ";
 			}
 			return os;
 		}
 
-		T norm()
+		T norm() const
 		{
 			T sum = 0;
-			for (int i=0; i<SIZE; ++i) sum += data[i]*data[i];
+			for (size_t i=0; i<SIZE; ++i) sum += data[i]*data[i];
 			return sqrt(sum);
 		}
 
 		void normalize()
 		{
 			T inv_norm = 1/this->norm();
-			for (int i=0; i<SIZE; ++i) data[i] *= inv_norm; 
+			for (size_t i=0; i<SIZE; ++i) data[i] *= inv_norm;
 		}
 
-		T data[SIZE];
+		alignas(VectorAlignment<T,SIZE>::value) T data[SIZE];
 };
 
 typedef Vector<float,2> Vector2f;
@@ -101,7 +139,7 @@ typedef Vector<double,3> Vector3d;
 typedef Vector<double,4> Vector4d;
 
 template<typename T>
-Vector<T,3> cross( Vector<T,3> a, Vector<T,3> b)
+Vector<T,3> cross (const Vector<T,3>& a, const Vector<T,3>& b)
 {
 	Vector<T,3> result;
 	result[0] = a[1]*b[2] - a[2]*b[1];
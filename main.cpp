@@ -1,31 +1,397 @@
 #include <iostream>
 #include <vector>
 #include <cstring>
+#include <csignal>
+#include <atomic>
 
 #include "linalgebra.hpp"
 #include "meshio.hpp"
 #include "mesh.hpp"
+#include "pipeline.hpp"
+#include "batch.hpp"
+#include "blocked.hpp"
+#include "patch.hpp"
+
+void printUsage ()
+{
+	std::cout << "Usage: ./subdivide [--progressive | --blocked <cache_kb> | --patches] [--weld <tolerance>] [--profile] [--bits <n>] [--budget <seconds>] [--progress] <meshpath> <outputpath> <butterfly | loop | sqrt3> <iterations>" << std::endl;
+	std::cout << "       ./subdivide --pipeline <butterfly | loop | sqrt3> <iterations> <meshpath> <outputpath> [<meshpath> <outputpath> ...]" << std::endl;
+	std::cout << "       ./subdivide --frames <butterfly | loop | sqrt3> <iterations> <output> <frame.obj> [<frame.obj> ...]" << std::endl;
+	std::cout << "Example: ./subdivide bunny_1k.obj output.obj butterfly 2" << std::endl;
+	std::cout << "  --progressive  write every level as a progressive OBJ (base mesh plus per-level deltas)" << std::endl;
+	std::cout << "  --blocked      refine clusters of faces depth-first, each sized to fit <cache_kb> of cache" << std::endl;
+	std::cout << "  --patches      store each refined control face as an implicit regular grid" << std::endl;
+	std::cout << "  --weld         merge vertices closer than <tolerance> while loading" << std::endl;
+	std::cout << "  --profile      report allocations, bytes, peak live bytes and process peak RSS per phase" << std::endl;
+	std::cout << "  --bits         quantisation bits per coordinate for .subz output (default 16)" << std::endl;
+	std::cout << "                 a <meshpath> or <outputpath> ending in .subz is read or written compressed," << std::endl;
+	std::cout << "                 except that --progressive output cannot be .subz" << std::endl;
+	std::cout << "  --budget       stop at the finest level reachable within <seconds>" << std::endl;
+	std::cout << "  --progress     report the progress of loading, every level and writing" << std::endl;
+	std::cout << "                 with either option, Ctrl-C keeps the last completed level" << std::endl;
+	std::cout << "                 neither option is available with --patches or --blocked" << std::endl;
+	std::cout << "  --frames       refine frames sharing one topology together; <output> ending in .cache" << std::endl;
+	std::cout << "                 writes one binary cache, otherwise <output>N.obj is written per frame" << std::endl;
+	std::cout << "  --pipeline and --frames must come first and take none of the other options" << std::endl;
+}
+
+int rejectOptions (const char* mode, const char* option)
+{
+	std::cout << "\"" << option << "\" cannot be combined with " << mode << "." << std::endl;
+	return -1;
+}
+
+bool hasSuffix (const std::string& path, const char* suffix)
+{
+	size_t n = strlen (suffix);
+	return path.size() > n && path.compare (path.size()-n, n, suffix) == 0;
+}
+
+// Packed output of patch and blocked refinement, as SUBZ or OBJ by suffix.
+int writeRefined (const std::string& path, const std::vector<float>& positions, const std::vector<int>& indices, int bits)
+{
+	if (hasSuffix (path, ".subz"))
+		return MeshIO<MeshFileType::SUBZ>::writeMesh (path, positions, indices, bits);
+
+	std::ofstream fs (path, std::ofstream::out);
+	if (!fs)
+	{
+		std::cout << "Output file \"" << path << "\" could not be opened." << std::endl;
+		return -1;
+	}
+	return MeshIO<MeshFileType::OBJ>::writeMesh (fs, positions, indices);
+}
+
+// Swapped by main while the handler is installed, so the handler may only
+// touch it through a lock-free atomic load.
+static_assert (ATOMIC_POINTER_LOCK_FREE == 2, "the interrupt handler needs a lock-free pointer");
+static std::atomic<ExecutionContext*> interrupt_context (NULL);
+
+void cancelOnInterrupt (int)
+{
+	ExecutionContext* context = interrupt_context.load();
+	if (context)
+		context->cancel();
+}
+
+void printProgress (const char* phase, double fraction)
+{
+	std::cout << "\r" << phase << " " << (int)(100*fraction) << "%        " << std::flush;
+}
+
+int parseScheme (const char* name, SubdivisionScheme& scheme)
+{
+	if (strcmp(name,"butterfly") == 0)
+		scheme = BUTTERFLY;
+	else if (strcmp(name,"loop") == 0)
+		scheme = LOOP;
+	else if (strcmp(name,"sqrt3") == 0)
+		scheme = SQRT3;
+	else
+	{
+		std::cout << "Unknown subdivision scheme \"" << name << "\"." << std::endl;
+		return -1;
+	}
+	return 0;
+}
+
+int runFrames (SubdivisionScheme scheme, int iterations, std::string output, int num_frames, char** frames)
+{
+	std::vector<Vector3f> coarse;
+	std::vector<int> indices;
+	if (MeshIO<MeshFileType::OBJ>::loadMesh (frames[0], coarse, indices) < 0)
+		return -1;
+
+	StandardMesh mesh;
+	mesh.generateMesh (coarse, indices);
+
+	FrameBatch batch (num_frames);
+	if (batch.refine (mesh, scheme, iterations) < 0)
+	{
+		std::cout << "Refining \"" << frames[0] << "\" failed." << std::endl;
+		return -1;
+	}
+	batch.setFrame (0, coarse);
+
+	for (int f=1; f<num_frames; ++f)
+	{
+		std::vector<Vector3f> frame_vertices;
+		std::vector<int> frame_indices;
+		if (MeshIO<MeshFileType::OBJ>::loadMesh (frames[f], frame_vertices, frame_indices) < 0)
+			return -1;
+		if (frame_indices != indices || batch.setFrame (f, frame_vertices) < 0)
+		{
+			std::cout << "Frame \"" << frames[f] << "\" does not share the topology of \"" << frames[0] << "\"." << std::endl;
+			return -1;
+		}
+	}
+
+	batch.evaluate();
+
+	std::vector<int> refined_indices (mesh.faces.size()*POLY_SIZE);
+	mesh.exportIndices (refined_indices.data());
+
+	if (hasSuffix (output, ".cache"))
+		return writeFrameCache (output, batch, refined_indices);
+
+	std::vector<float> positions;
+	for (int f=0; f<num_frames; ++f)
+	{
+		batch.getFrame (f, positions);
+		std::ofstream fs (output + std::to_string(f) + ".obj", std::ofstream::out);
+		MeshIO<MeshFileType::OBJ>::writeMesh (fs, positions, refined_indices);
+	}
+
+	return 0;
+}
 
 int main(int argc, char** argv)
 {
-	if(argc != 5)
+	SubdivisionScheme scheme;
+
+	if (argc >= 3 && (strcmp(argv[1],"--pipeline") == 0 || strcmp(argv[1],"--frames") == 0) && strncmp(argv[2],"--",2) == 0)
+		return rejectOptions (argv[1], argv[2]);
+
+	if (argc >= 6 && strcmp(argv[1],"--pipeline") == 0 && (argc-4) % 2 == 0)
 	{
-		std::cout << "Invalid Arguments. Usage: ./subdivide <meshpath> <outputpath> <butterfly | loop> <iterations>" << std::endl;
-		std::cout << "Example: ./subdivide bunny_1k.obj output.obj butterfly 2" << std::endl;
+		if (parseScheme (argv[2], scheme) < 0)
+			return -1;
+
+		std::vector<PipelineJob> jobs ((argc-4)/2);
+		for (size_t i=0; i<jobs.size(); ++i)
+		{
+			jobs[i].input = argv[4+2*i];
+			jobs[i].output = argv[5+2*i];
+		}
+		return runPipeline (jobs, scheme, std::stoi(argv[3]));
+	}
+
+	if (argc >= 6 && strcmp(argv[1],"--frames") == 0)
+	{
+		if (parseScheme (argv[2], scheme) < 0)
+			return -1;
+
+		return runFrames (scheme, std::stoi(argv[3]), argv[4], argc-5, argv+5);
+	}
+
+	bool progressive = false;
+	bool patches = false;
+	float weld_tolerance = -1;
+	int cache_kb = 0;
+	int bits = 16;
+	bool profile = false;
+	AllocationProfile phases;
+	ExecutionContext context;
+	bool use_context = false;
+	bool show_progress = false;
+	int arg = 1;
+	while (arg < argc && strncmp(argv[arg],"--",2) == 0)
+	{
+		if (strcmp(argv[arg],"--progressive") == 0)
+			progressive = true;
+		else if (strcmp(argv[arg],"--blocked") == 0 && arg+1 < argc)
+			cache_kb = std::stoi (argv[++arg]);
+		else if (strcmp(argv[arg],"--patches") == 0)
+			patches = true;
+		else if (strcmp(argv[arg],"--profile") == 0)
+			profile = true;
+		else if (strcmp(argv[arg],"--weld") == 0 && arg+1 < argc)
+			weld_tolerance = std::stof (argv[++arg]);
+		else if (strcmp(argv[arg],"--bits") == 0 && arg+1 < argc)
+			bits = std::stoi (argv[++arg]);
+		else if (strcmp(argv[arg],"--budget") == 0 && arg+1 < argc)
+		{
+			context.setBudget (std::stod (argv[++arg]));
+			use_context = true;
+		}
+		else if (strcmp(argv[arg],"--progress") == 0)
+		{
+			context.setProgressCallback (printProgress);
+			use_context = true;
+			show_progress = true;
+		}
+		else if (arg > 1 && (strcmp(argv[arg],"--pipeline") == 0 || strcmp(argv[arg],"--frames") == 0))
+			return rejectOptions (argv[arg], argv[1]);
+		else
+		{
+			std::cout << "Unknown option \"" << argv[arg] << "\". ";
+			printUsage();
+			return -1;
+		}
+		arg++;
+	}
+
+	if(argc - arg != 4)
+	{
+		std::cout << "Invalid Arguments. ";
+		printUsage();
+		return -1;
+	}
+
+	char** args = argv + arg;
+	if (parseScheme (args[2], scheme) < 0)
+		return -1;
+
+	if (progressive && hasSuffix (args[1], ".subz"))
+	{
+		std::cout << "--progressive writes progressive OBJ and cannot write a .subz file." << std::endl;
 		return -1;
 	}
 
+	if (use_context && (patches || cache_kb > 0))
+	{
+		std::cout << "--budget and --progress cannot be combined with " << (patches ? "--patches" : "--blocked") << "." << std::endl;
+		return -1;
+	}
+
+	if (profile)
+		allocationCounters().enable();
+
 	Mesh<float,float> mesh;
-	
-	MeshIO<MeshFileType::OBJ>::loadMesh (argv[1], mesh);
-	for (int i=0; i<std::stoi(argv[4]); ++i)
+	if (use_context)
+	{
+		mesh.context = &context;
+		interrupt_context = &context;
+		signal (SIGINT, cancelOnInterrupt);
+	}
+
+	if (profile) phases.begin ("load");
+	int loaded;
+	if (hasSuffix (args[0], ".subz"))
+		loaded = MeshIO<MeshFileType::SUBZ>::loadMesh (args[0], mesh);
+	else if (weld_tolerance >= 0)
+		loaded = MeshIO<MeshFileType::OBJ>::loadMesh (args[0], mesh, weld_tolerance, mesh.context);
+	else
+		loaded = MeshIO<MeshFileType::OBJ>::loadMesh (args[0], mesh, mesh.context);
+	if (loaded < 0)
+		return -1;
+
+	if ((cache_kb > 0 || patches) && scheme == SQRT3)
+	{
+		std::cout << "Blocked and patch refinement support the loop and butterfly schemes only." << std::endl;
+		return -1;
+	}
+
+	if (patches)
+	{
+		std::vector<Vector3f> coarse;
+		std::vector<int> indices (mesh.faces.size()*POLY_SIZE);
+		for (auto it = mesh.vertices.begin(); it!=mesh.vertices.end(); it++)
+			coarse.push_back (it->position);
+		mesh.exportIndices (indices.data());
+		mesh.faces.clear();
+		mesh.halfedges.clear();
+		mesh.vertices.clear();
+
+		PatchMesh patch_mesh (coarse, indices, scheme);
+		for (int i=0; i<std::stoi(args[3]); ++i)
+		{
+			if (profile) phases.begin ("level " + std::to_string(i+1));
+			if (patch_mesh.subdivide() < 0)
+			{
+				std::cout << "Patch refinement failed: the mesh must be closed." << std::endl;
+				return -1;
+			}
+		}
+
+		if (profile) phases.begin ("write");
+		std::vector<float> positions;
+		std::vector<int> refined_indices;
+		patch_mesh.exportMesh (positions, refined_indices);
+		int written = writeRefined (args[1], positions, refined_indices, bits);
+
+		if (profile) phases.report (std::cout);
+		return written;
+	}
+
+	if (cache_kb > 0)
+	{
+		std::vector<Vector3f> coarse;
+		std::vector<int> indices (mesh.faces.size()*POLY_SIZE);
+		for (auto it = mesh.vertices.begin(); it!=mesh.vertices.end(); it++)
+			coarse.push_back (it->position);
+		mesh.exportIndices (indices.data());
+
+		if (profile) phases.begin ("refine");
+		std::vector<float> positions;
+		std::vector<int> refined_indices;
+		BlockedRefiner refiner (coarse, indices, scheme, std::stoi(args[3]));
+		if (refiner.run (positions, refined_indices, (size_t)cache_kb << 10) < 0)
+		{
+			std::cout << "Blocked refinement failed: the mesh must be closed." << std::endl;
+			return -1;
+		}
+
+		if (profile) phases.begin ("write");
+		int written = writeRefined (args[1], positions, refined_indices, bits);
+
+		if (profile) phases.report (std::cout);
+		return written;
+	}
+
+	if (progressive)
 	{
-		if(strcmp(argv[3],"butterfly") == 0)
-			mesh.butterflySubdivision();
-		if(strcmp(argv[3],"loop") == 0)
-			mesh.loopSubdivision();
+		if (profile) phases.begin ("write level 0");
+		std::ofstream fs (args[1], std::ofstream::out);
+		size_t num_written = 0;
+		MeshIO<MeshFileType::POBJ>::writeLevel (fs, mesh, 0, scheme, num_written);
+		int levels = std::stoi (args[3]);
+		int done = 0;
+		for (; done<levels; ++done)
+		{
+			if (profile) phases.begin ("level " + std::to_string(done+1));
+			if (mesh.subdivide (scheme) != 0)
+				break;
+			if (profile) phases.begin ("write level " + std::to_string(done+1));
+			MeshIO<MeshFileType::POBJ>::writeLevel (fs, mesh, done+1, scheme, num_written);
+		}
+		if (show_progress)
+			std::cout << std::endl;
+		if (done < levels)
+			std::cout << "Stopped at level " << done << " of " << levels << "." << std::endl;
+
+		if (profile) phases.report (std::cout);
+		return 0;
 	}
-	MeshIO<MeshFileType::OBJ>::writeMesh (argv[2], mesh);
+
+	if (use_context)
+	{
+		if (profile) phases.begin ("refine");
+		int levels = std::stoi (args[3]);
+		int done = mesh.subdivideWithin (scheme, levels);
+		if (show_progress)
+			std::cout << std::endl;
+		if (done < levels)
+			std::cout << "Stopped at level " << done << " of " << levels << "." << std::endl;
+	}
+	else
+	{
+		for (int i=0; i<std::stoi(args[3]); ++i)
+		{
+			if (profile) phases.begin ("level " + std::to_string(i+1));
+			if (mesh.subdivide (scheme) != 0)
+				return -1;
+		}
+	}
+
+	// The last completed level is written even when the budget ran out;
+	// only a further interrupt stops the write.
+	if (profile) phases.begin ("write");
+	ExecutionContext write_context;
+	if (show_progress)
+		write_context.setProgressCallback (printProgress);
+	interrupt_context = &write_context;
+	int written;
+	if (hasSuffix (args[1], ".subz"))
+		written = MeshIO<MeshFileType::SUBZ>::writeMesh (args[1], mesh, bits);
+	else
+		written = MeshIO<MeshFileType::OBJ>::writeMesh (args[1], mesh, use_context ? &write_context : NULL);
+	if (show_progress)
+		std::cout << std::endl;
+	if (written < 0)
+		return -1;
+
+	if (profile) phases.report (std::cout);
 
 	return 0;
 }
@@ -4,16 +4,40 @@
 #define _USE_MATH_DEFINES
 
 #include "linalgebra.hpp"
+#include "profile.hpp"
+#include "context.hpp"
 #include <utility>
 #include <vector>
 #include <list>
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <functional>
 #include <map>
+#include <unordered_map>
 #include <memory>
 
 const int POLY_SIZE = 3;
 
+// Returned by Mesh::subdivide when its ExecutionContext stopped the level.
+const int SUBDIVISION_STOPPED = 1;
+
+// Containers owned by Mesh and the scratch vectors of its algorithms go
+// through CountingAllocator, so their traffic shows up in profiles.
+template <typename T>
+using MeshList = std::list<T, CountingAllocator<T> >;
+
+template <typename T>
+using ScratchVector = std::vector<T, CountingAllocator<T> >;
+
+template <typename K, typename T>
+using ScratchMap = std::unordered_map<K, T, std::hash<K>, std::equal_to<K>, CountingAllocator<std::pair<const K, T> > >;
+
+enum SubdivisionScheme
+{
+	LOOP, BUTTERFLY, SQRT3
+};
+
 template <typename V, typename H>
 struct THalfedge;
 
@@ -23,10 +47,10 @@ class Mesh;
 template <typename V, typename H>
 struct TVertex
 {
-	TVertex (Vector3f pos){ position = pos; }
+	TVertex (const Vector3f& pos) : position(pos) {}
 	TVertex (){}
 
-	typename std::list<THalfedge<V,H> >::iterator outHalfedge;
+	typename MeshList<THalfedge<V,H> >::iterator outHalfedge;
 	int id;
 	V data;
 	Vector3f position;
@@ -34,34 +58,87 @@ struct TVertex
 	Mesh<V,H>* mesh_ref;
 };
 
+// Weight of a vertex in its own Loop smoothing rule, n being its valence.
+inline float loopAlpha (int n)
+{
+	return (3.f/8.f) + ((3.f/8.f) + (1.f/4.f)*cos(2*M_PI/n))*((3.f/8.f) + (1.f/4.f)*cos(2*M_PI/n));
+}
+
 template <typename A, typename B>
-std::vector<std::pair<A,B> > getAllPairsWithSecond (std::vector<std::pair<A,B> >& v, B b)
+ScratchVector<std::pair<A,B> > getAllPairsWithSecond (ScratchVector<std::pair<A,B> >& v, B b)
 {
-	std::vector<std::pair<A,B> > result;
-	for (int i=0; i<v.size(); ++i)
+	ScratchVector<std::pair<A,B> > result;
+	for (size_t i=0; i<v.size(); ++i)
 		if (v[i].second == b) result.push_back (v[i]);
 
 	return result;
 }
 
 template <typename A, typename B>
-std::vector<std::pair<A,B> > getAllPairsWithFirst (std::vector<std::pair<A,B> >& v, A a)
+ScratchVector<std::pair<A,B> > getAllPairsWithFirst (ScratchVector<std::pair<A,B> >& v, A a)
 {
-	std::vector<std::pair<A,B> > result;
-	for (int i=0; i<v.size(); ++i)
+	ScratchVector<std::pair<A,B> > result;
+	for (size_t i=0; i<v.size(); ++i)
 		if (v[i].first == a) result.push_back (v[i]);
 
 	return result;
 }
 
 
+// Linear rules of one subdivision level in compressed rows: vertex
+// targets[k] becomes the weighted sum of sources/weights in
+// [offsets[k], offsets[k+1]). Sources always refer to positions of the
+// previous level; vertices without a row keep their position.
+struct StencilTable
+{
+	StencilTable () : offsets(1,0) {}
+
+	void beginRow (int target) { targets.push_back (target); offsets.push_back (offsets.back()); }
+
+	void addWeight (int source, float weight)
+	{
+		sources.push_back (source);
+		weights.push_back (weight);
+		offsets.back()++;
+	}
+
+	size_t size () const { return targets.size(); }
+
+	// Drops every row after the first 'rows'.
+	void resize (size_t rows)
+	{
+		targets.resize (rows);
+		offsets.resize (rows+1);
+		sources.resize (offsets.back());
+		weights.resize (offsets.back());
+	}
+
+	std::vector<int> targets;
+	std::vector<int> offsets;
+	std::vector<int> sources;
+	std::vector<float> weights;
+};
+
+// Vertex one-rings in compressed rows: the neighbours of vertex v are
+// neighbours[offsets[v]] .. neighbours[offsets[v+1]-1], in fan order
+// around v; an open fan runs from boundary to boundary.
+struct OneRingTable
+{
+	int valence (int v) const { return offsets[v+1] - offsets[v]; }
+	const int* begin (int v) const { return neighbours.data() + offsets[v]; }
+	const int* end (int v) const { return neighbours.data() + offsets[v+1]; }
+
+	ScratchVector<int> offsets;
+	ScratchVector<int> neighbours;
+};
+
 template <typename V, typename H>
 struct TFace
 {
 	TFace() : halfedge(NULL){}
-	TFace (typename std::list<THalfedge<V,H> >::iterator he) : halfedge(he){}
+	TFace (typename MeshList<THalfedge<V,H> >::iterator he) : halfedge(he){}
 
-	typename std::list<THalfedge<V,H> >::iterator halfedge;
+	typename MeshList<THalfedge<V,H> >::iterator halfedge;
 	int id;
 
 	Mesh<V,H>* mesh_ref;
@@ -72,20 +149,20 @@ struct THalfedge
 {
 	THalfedge(){}
 
-	typename std::list<TVertex<V,H> >::iterator sink;
-	typename std::list<TFace<V,H> >::iterator face;
-	typename std::list<THalfedge<V,H> >::iterator next;
-	typename std::list<THalfedge<V,H> >::iterator opposite;
-	typename std::list<THalfedge<V,H> >::iterator prev;
+	typename MeshList<TVertex<V,H> >::iterator sink;
+	typename MeshList<TFace<V,H> >::iterator face;
+	typename MeshList<THalfedge<V,H> >::iterator next;
+	typename MeshList<THalfedge<V,H> >::iterator opposite;
+	typename MeshList<THalfedge<V,H> >::iterator prev;
 
-	typename std::list<THalfedge<V,H> >::iterator nextOverLine()
+	typename MeshList<THalfedge<V,H> >::iterator nextOverLine()
 	{
 		auto result = next;
 		if (next->opposite->face == opposite->face) return result->next;
 		else return result;
 	}
 	
-	typename std::list<THalfedge<V,H> >::iterator prevOverLine()
+	typename MeshList<THalfedge<V,H> >::iterator prevOverLine()
 	{
 		auto result = prev;
 		if (prev->opposite->face == opposite->face) return result->prev;
@@ -103,7 +180,7 @@ template <typename V, typename H>
 class Mesh
 {
 	public:
-		Mesh(){}
+		Mesh() : stencil_log(NULL), context(NULL) {}
 
 		void addVertex (TVertex<V,H> v)
 		{
@@ -126,21 +203,84 @@ class Mesh
 			faces.push_back(f);
 		}
 
-		void generateMesh (std::vector<Vector3f>& raw_vertices, std::vector<int>& indices)
+		template <typename VertexVector, typename IndexVector>
+		void generateMesh (const VertexVector& raw_vertices, const IndexVector& indices)
 		{
-			std::vector<std::pair<int,int> >edges;
-			std::vector<int> edge_he;
-
 			for (size_t i=0; i<raw_vertices.size(); ++i)
 			{
 				addVertex (TVertex<V,H> (raw_vertices[i]));
 			}
 
-			for (size_t i=0; i<indices.size(); ++i)
+			generateTopology (indices.data(), indices.size());
+		}
+
+		// Builds the mesh straight from caller-owned arrays: positions holds
+		// num_vertices packed xyz triples, indices holds POLY_SIZE entries per face.
+		void generateMesh (
+				const float* positions,
+				size_t num_vertices,
+				const int* indices,
+				size_t num_indices
+		)
+		{
+			for (size_t i=0; i<num_vertices; ++i)
+			{
+				addVertex (TVertex<V,H> (Vector3f (positions[3*i], positions[3*i+1], positions[3*i+2])));
+			}
+
+			generateTopology (indices, num_indices);
+		}
+
+		// Writes positions and face indices in the same order as the OBJ writer.
+		// positions needs room for 3*vertices.size() floats and indices for
+		// POLY_SIZE*faces.size() ints.
+		void exportMesh (float* positions, int* indices)
+		{
+			for (auto it = vertices.begin(); it!=vertices.end(); it++)
+			{
+				*positions++ = it->position[0];
+				*positions++ = it->position[1];
+				*positions++ = it->position[2];
+			}
+
+			exportIndices (indices);
+		}
+
+		void exportIndices (int* indices)
+		{
+			for (auto fit = faces.begin(); fit!=faces.end(); fit++)
+			{
+				auto it = fit->halfedge;
+				do {
+					*indices++ = it->sink->id;
+					it = it->next;
+				} while (it != fit->halfedge);
+			}
+		}
+
+		void generateTopology (const int* indices, size_t num_indices)
+		{
+			std::map<std::pair<int,int>,int,std::less<std::pair<int,int> >,CountingAllocator<std::pair<const std::pair<int,int>,int> > > edge_he;
+			// halfedges.end() marks a missing link: the opposite of a boundary
+			// halfedge and the outgoing halfedge of an unreferenced vertex.
+			ScratchVector<typename MeshList<TVertex<V,H> >::iterator> vertex_its;
+			vertex_its.reserve (vertices.size());
+			for (auto it = vertices.begin(); it!=vertices.end(); it++)
+			{
+				it->outHalfedge = halfedges.end();
+				vertex_its.push_back (it);
+			}
+
+			ScratchVector<typename MeshList<THalfedge<V,H> >::iterator> halfedge_its;
+			halfedge_its.reserve (num_indices);
+
+			for (size_t i=0; i<num_indices; ++i)
 			{
 				THalfedge<V,H> new_halfedge;
 				addHalfedge (new_halfedge);
-				typename std::list<THalfedge<V,H> >::iterator h = std::prev(halfedges.end(),1);
+				typename MeshList<THalfedge<V,H> >::iterator h = std::prev(halfedges.end(),1);
+				h->opposite = halfedges.end();
+				halfedge_its.push_back (h);
 
 				if (i % POLY_SIZE != 0)
 				{
@@ -148,38 +288,32 @@ class Mesh
 					h->prev->next = h;
 				}
 
-				std::next(vertices.begin(), indices[i])->outHalfedge = h;
+				vertex_its[indices[i]]->outHalfedge = h;
 				std::pair<int,int> new_edge;
 				if ((i+1) % POLY_SIZE != 0)
 				{
-					h->sink = std::next(vertices.begin(),indices[i+1]);
+					h->sink = vertex_its[indices[i+1]];
 					new_edge = std::make_pair (indices[i], indices[i+1]);
 				}
 				else 
 				{
-					h->sink = std::next(vertices.begin(),indices[i+1-POLY_SIZE]);
+					h->sink = vertex_its[indices[i+1-POLY_SIZE]];
 					new_edge = std::make_pair (indices[i], indices[i+1-POLY_SIZE]);
 				}
-				edges.push_back(new_edge);
-				edge_he.push_back(h->id);
-				int pos = -1;
-				for (size_t e=0; e<edges.size(); ++e)
-				{
-					if (edges[e] == std::make_pair (new_edge.second, new_edge.first))
-						pos = e;
-				}
+				edge_he[new_edge] = i;
 
-				if( pos != -1 )
+				auto pos = edge_he.find (std::make_pair (new_edge.second, new_edge.first));
+				if( pos != edge_he.end() )
 				{
-					std::next(halfedges.begin(),edge_he[pos])->opposite = h;
-					h->opposite = std::next(halfedges.begin(),edge_he[pos]);
+					halfedge_its[pos->second]->opposite = h;
+					h->opposite = halfedge_its[pos->second];
 				}
 
 				if (((i+1) % POLY_SIZE) == 0)
 				{
 					addFace (TFace<V,H>(h));
 
-					typename std::list<THalfedge<V,H> >::iterator it = h;
+					typename MeshList<THalfedge<V,H> >::iterator it = h;
 					for (int i=0; i<POLY_SIZE-1; ++i)
 					{
 						it->face = std::prev(faces.end(),1);
@@ -190,49 +324,138 @@ class Mesh
 					h->next->face = std::prev(faces.end(),1);
 				}
 			}
+
+			buildOneRing();
+		}
+
+		// Rebuilds the one-ring table from the halfedges. Every subdivision
+		// level does this once it is done, so the next level and any one-ring
+		// query read plain arrays.
+		//
+		// On a boundary the fan around a vertex is open: the walk starts at
+		// its first outgoing halfedge and ends with the source of the last
+		// incoming one. Unreferenced vertices get an empty ring.
+		void buildOneRing ()
+		{
+			one_ring.offsets.assign (1, 0);
+			one_ring.offsets.reserve (vertices.size()+1);
+			one_ring.neighbours.clear();
+			one_ring.neighbours.reserve (halfedges.size());
+			for (auto v = vertices.begin(); v!=vertices.end(); v++)
+			{
+				// Edges of more than two faces can leave links that never lead
+				// back, so neither walk takes more steps than there are halfedges.
+				auto first = v->outHalfedge;
+				size_t steps = 0;
+				if (first != halfedges.end())
+				{
+					while (first->opposite != halfedges.end() && first->opposite->next != v->outHalfedge && ++steps < halfedges.size())
+						first = first->opposite->next;
+					if (first->opposite != halfedges.end())
+						first = v->outHalfedge;
+
+					auto it = first;
+					steps = 0;
+					do{
+						one_ring.neighbours.push_back (it->sink->id);
+						if (it->prev->opposite == halfedges.end())
+						{
+							one_ring.neighbours.push_back (it->prev->prev->sink->id);
+							break;
+						}
+						it = it->prev->opposite;
+					} while (it != first && ++steps < halfedges.size());
+				}
+				one_ring.offsets.push_back (one_ring.neighbours.size());
+			}
+		}
+
+		// True if every edge has two faces and the faces around every vertex
+		// form one closed fan, which the subdivision rules assume.
+		bool isClosedManifold ()
+		{
+			ScratchVector<int> outgoing (vertices.size(), 0);
+			for (auto it = halfedges.begin(); it!=halfedges.end(); it++)
+			{
+				if (it->opposite == halfedges.end())
+					return false;
+				outgoing[it->prev->sink->id]++;
+			}
+			const OneRingTable& ring = oneRing();
+			for (size_t v=0; v<vertices.size(); ++v)
+				if (outgoing[v] == 0 || ring.valence (v) != outgoing[v])
+					return false;
+			return true;
+		}
+
+		const OneRingTable& oneRing ()
+		{
+			if (one_ring.offsets.size() != vertices.size()+1)
+				buildOneRing();
+			return one_ring;
+		}
+
+		ScratchVector<Vector3f> gatherPositions ()
+		{
+			ScratchVector<Vector3f> positions;
+			positions.reserve (vertices.size());
+			for (auto it = vertices.begin(); it!=vertices.end(); it++)
+				positions.push_back (it->position);
+			return positions;
 		}
 
 		int loopSubdivision()
 		{
-			std::vector<int> splitted;
-			size_t num_halfedges = halfedges.size();
 			size_t old_verts = vertices.size();
 
-			std::vector< std::pair<typename std::list<TVertex<V,H> >::iterator,int> > new_vertices_faces;
-			std::vector< std::pair<typename std::list<THalfedge<V,H> >::iterator,int> > new_halfedges_faces;
-			std::map< int, std::vector<typename std::list<TVertex<V,H> >::iterator> > vert_one_ring;
+			ScratchVector< std::pair<typename MeshList<TVertex<V,H> >::iterator,int> > new_vertices_faces;
+			ScratchVector< std::pair<typename MeshList<THalfedge<V,H> >::iterator,int> > new_halfedges_faces;
 
-			for (auto it = vertices.begin(); it!=vertices.end(); it++)
+			ScratchVector<Vector3f> old_positions = gatherPositions();
+			const OneRingTable& ring = oneRing();
+			ScratchVector<Vector3f> vertex_points;
+			vertex_points.reserve (old_verts);
+			for (size_t v=0; v<old_verts; ++v)
 			{
-				vert_one_ring[it->id] = getOneRing(it);
+				if (interrupted ("vertex points", v, old_verts)) return SUBDIVISION_STOPPED;
+				vertex_points.push_back (loopVertexPoint (v, ring, old_positions));
 			}
 
-			for (size_t i=0; i<num_halfedges; ++i)
+			auto split_edges = edgesToSplit();
+			ScratchVector<Vector3f> edge_points;
+			edge_points.reserve (split_edges.size());
+			for (size_t i=0; i<split_edges.size(); ++i)
 			{
-				if (std::find (splitted.begin(), splitted.end(), i) == splitted.end())
-				{
-					auto nvert = loopSplitEdge(i);
-					new_vertices_faces.push_back (std::make_pair(nvert, nvert->outHalfedge->face->id));
-					new_vertices_faces.push_back (std::make_pair(nvert, nvert->outHalfedge->opposite->face->id));
-					new_halfedges_faces.push_back (std::make_pair(nvert->outHalfedge, nvert->outHalfedge->face->id));
-					splitted.push_back(i);
-					splitted.push_back( std::next(halfedges.begin(),i)->opposite->id);
-				}
+				if (interrupted ("edge points", i, split_edges.size())) return SUBDIVISION_STOPPED;
+				edge_points.push_back (loopEdgePoint (split_edges[i], old_verts + i));
+			}
+			if (positions_ready)
+				positions_ready (vertex_points, edge_points);
+
+			for (size_t i=0; i<split_edges.size(); ++i)
+			{
+				if (interrupted ("split edges", i, split_edges.size())) return SUBDIVISION_STOPPED;
+				auto nvert = splitEdge (split_edges[i], edge_points[i]);
+				new_vertices_faces.push_back (std::make_pair(nvert, nvert->outHalfedge->face->id));
+				new_vertices_faces.push_back (std::make_pair(nvert, nvert->outHalfedge->opposite->face->id));
+				new_halfedges_faces.push_back (std::make_pair(nvert->outHalfedge, nvert->outHalfedge->face->id));
 			}
 			
 			faces.clear();
 
-			std::vector<typename std::list<TVertex<V,H> >::iterator> vstart;
-			std::vector<typename std::list<TVertex<V,H> >::iterator> vend;
-			std::vector<typename std::list<THalfedge<V,H> >::iterator> hedges;
-			num_halfedges = halfedges.size();
+			ScratchVector<typename MeshList<TVertex<V,H> >::iterator> vstart;
+			ScratchVector<typename MeshList<TVertex<V,H> >::iterator> vend;
+			ScratchVector<typename MeshList<THalfedge<V,H> >::iterator> hedges;
 
-			for (auto vit = vertices.begin(); vit != std::next(vertices.begin(), old_verts); vit++)
+			size_t corners_done = 0;
+			auto old_end = std::next (vertices.begin(), old_verts);
+			for (auto vit = vertices.begin(); vit != old_end; vit++)
 			{
-				typename std::list<THalfedge<V,H> >::iterator it = vit->outHalfedge;
+				if (interrupted ("corner faces", corners_done++, old_verts)) return SUBDIVISION_STOPPED;
+				typename MeshList<THalfedge<V,H> >::iterator it = vit->outHalfedge;
 				do{
 					addHalfedge (THalfedge<V,H>());
-					typename std::list<THalfedge<V,H> >::iterator nhe = std::prev(halfedges.end(),1);
+					typename MeshList<THalfedge<V,H> >::iterator nhe = std::prev(halfedges.end(),1);
 					nhe->prev = it;
 					nhe->next = it->prev;
 					nhe->sink = nhe->next->prev->sink;
@@ -241,7 +464,7 @@ class Mesh
 					nhe->opposite = halfedges.end();
 
 					addFace (TFace<V,H>(nhe));
-					typename std::list<TFace<V,H> >::iterator nf = std::prev(faces.end(),1);
+					typename MeshList<TFace<V,H> >::iterator nf = std::prev(faces.end(),1);
 					nhe->face = nf;
 					nhe->next->face = nf;
 					nhe->next->next->face = nf;
@@ -250,23 +473,29 @@ class Mesh
 				} while (it != vit->outHalfedge);
 			}
 
-			std::vector< std::pair<typename std::list<TVertex<V,H> >::iterator,int> > query;
-			std::vector<int> filled_faces;
+			ScratchVector< std::pair<typename MeshList<TVertex<V,H> >::iterator,int> > query;
+			ScratchVector<int> face_offsets, face_entries;
+			groupByFace (new_vertices_faces, face_offsets, face_entries);
+			ScratchVector<char> filled (face_offsets.size(), 0);
 			for (size_t i=0; i< new_vertices_faces.size(); i++)
 			{
-				if (std::find (filled_faces.begin(), filled_faces.end(), new_vertices_faces[i].second) != filled_faces.end())
+				if (interrupted ("centre faces", i, new_vertices_faces.size(), 64)) return SUBDIVISION_STOPPED;
+				int old_face = new_vertices_faces[i].second;
+				if (filled[old_face])
 					continue;
-				query = getAllPairsWithSecond (new_vertices_faces, new_vertices_faces[i].second);
+				query.clear();
+				for (int k=face_offsets[old_face]; k<face_offsets[old_face+1]; ++k)
+					query.push_back (new_vertices_faces[face_entries[k]]);
 				assert (query.size() == 3);
 
 				addHalfedge (THalfedge<V,H>());
-				typename std::list<THalfedge<V,H> >::iterator he1 = std::prev(halfedges.end(),1);
+				typename MeshList<THalfedge<V,H> >::iterator he1 = std::prev(halfedges.end(),1);
 				addHalfedge (THalfedge<V,H>());
-				typename std::list<THalfedge<V,H> >::iterator he2 = std::prev(halfedges.end(),1);
+				typename MeshList<THalfedge<V,H> >::iterator he2 = std::prev(halfedges.end(),1);
 				addHalfedge (THalfedge<V,H>());
-				typename std::list<THalfedge<V,H> >::iterator he3 = std::prev(halfedges.end(),1);
+				typename MeshList<THalfedge<V,H> >::iterator he3 = std::prev(halfedges.end(),1);
 
-				typename std::list<THalfedge<V,H> >::iterator it = query[0].first->outHalfedge;
+				typename MeshList<THalfedge<V,H> >::iterator it = query[0].first->outHalfedge;
 				if (it->next->sink != query[1].first && it->next->sink != query[2].first)
 				{
 					it = it->opposite;
@@ -296,70 +525,66 @@ class Mesh
 				assert( he3->sink == query[0].first || he3->sink == query[1].first || he3->sink == query[2].first);
 
 				addFace (TFace<V,H>(he1));
-				typename std::list<TFace<V,H> >::iterator nf = std::prev(faces.end(),1);
+				typename MeshList<TFace<V,H> >::iterator nf = std::prev(faces.end(),1);
 				he1->face = he2->face = he3->face = nf;
-				filled_faces.push_back (new_vertices_faces[i].second);
+				filled[old_face] = 1;
 			}
 
-			for (auto it = halfedges.begin(); it!=halfedges.end(); it++)
-				updateOpposite (it);
+			if (updateOpposites() != 0) return SUBDIVISION_STOPPED;
 
-			for (auto it = vertices.begin(); it!=std::next(vertices.begin(),old_verts); it++)
+			size_t v = 0;
+			for (auto it = vertices.begin(); v<old_verts; it++, v++)
 			{
-				auto oneRing = vert_one_ring[it->id];
-				int n = oneRing.size();
-				float alpha_n = alpha (n);
-				Vector3f new_pos = alpha_n*it->position;
-
-				Vector3f sum({0,0,0}) ;
-				for (size_t pj = 0; pj<oneRing.size(); ++pj)
-				{
-					sum = sum + oneRing[pj]->position;
-				}
-
-				new_pos = new_pos + ((1-alpha_n)/n)*sum;
-				it->position = new_pos;
+				it->position = vertex_points[v];
 			}
 
+			buildOneRing();
+
 			return 0;
 		}
 
 		int butterflySubdivision()
 		{
-			std::vector<int> splitted;
-			size_t num_halfedges = halfedges.size();
 			size_t old_verts = vertices.size();
 
-			std::vector< std::pair<typename std::list<TVertex<V,H> >::iterator,int> > new_vertices_faces;
-			std::vector< std::pair<typename std::list<THalfedge<V,H> >::iterator,int> > new_halfedges_faces;
-			std::map< int, std::vector<typename std::list<TVertex<V,H> >::iterator> > vert_one_ring;
+			ScratchVector< std::pair<typename MeshList<TVertex<V,H> >::iterator,int> > new_vertices_faces;
+			ScratchVector< std::pair<typename MeshList<THalfedge<V,H> >::iterator,int> > new_halfedges_faces;
 
-			for (size_t i=0; i<num_halfedges; ++i)
+			auto split_edges = edgesToSplit();
+			ScratchVector<Vector3f> edge_points;
+			edge_points.reserve (split_edges.size());
+			for (size_t i=0; i<split_edges.size(); ++i)
 			{
-				if (std::find (splitted.begin(), splitted.end(), i) == splitted.end())
-				{
-					auto nvert = butterflySplitEdge(i);
-					new_vertices_faces.push_back (std::make_pair(nvert, nvert->outHalfedge->face->id));
-					new_vertices_faces.push_back (std::make_pair(nvert, nvert->outHalfedge->opposite->face->id));
-					new_halfedges_faces.push_back (std::make_pair(nvert->outHalfedge, nvert->outHalfedge->face->id));
-					splitted.push_back(i);
-					splitted.push_back( std::next(halfedges.begin(),i)->opposite->id);
-				}
+				if (interrupted ("edge points", i, split_edges.size())) return SUBDIVISION_STOPPED;
+				edge_points.push_back (butterflyEdgePoint (split_edges[i], old_verts + i));
+			}
+			if (positions_ready)
+				positions_ready (gatherPositions(), edge_points);
+
+			for (size_t i=0; i<split_edges.size(); ++i)
+			{
+				if (interrupted ("split edges", i, split_edges.size())) return SUBDIVISION_STOPPED;
+				auto nvert = splitEdge (split_edges[i], edge_points[i]);
+				new_vertices_faces.push_back (std::make_pair(nvert, nvert->outHalfedge->face->id));
+				new_vertices_faces.push_back (std::make_pair(nvert, nvert->outHalfedge->opposite->face->id));
+				new_halfedges_faces.push_back (std::make_pair(nvert->outHalfedge, nvert->outHalfedge->face->id));
 			}
 			
 			faces.clear();
 
-			std::vector<typename std::list<TVertex<V,H> >::iterator> vstart;
-			std::vector<typename std::list<TVertex<V,H> >::iterator> vend;
-			std::vector<typename std::list<THalfedge<V,H> >::iterator> hedges;
-			num_halfedges = halfedges.size();
+			ScratchVector<typename MeshList<TVertex<V,H> >::iterator> vstart;
+			ScratchVector<typename MeshList<TVertex<V,H> >::iterator> vend;
+			ScratchVector<typename MeshList<THalfedge<V,H> >::iterator> hedges;
 
-			for (auto vit = vertices.begin(); vit != std::next(vertices.begin(), old_verts); vit++)
+			size_t corners_done = 0;
+			auto old_end = std::next (vertices.begin(), old_verts);
+			for (auto vit = vertices.begin(); vit != old_end; vit++)
 			{
-				typename std::list<THalfedge<V,H> >::iterator it = vit->outHalfedge;
+				if (interrupted ("corner faces", corners_done++, old_verts)) return SUBDIVISION_STOPPED;
+				typename MeshList<THalfedge<V,H> >::iterator it = vit->outHalfedge;
 				do{
 					addHalfedge (THalfedge<V,H>());
-					typename std::list<THalfedge<V,H> >::iterator nhe = std::prev(halfedges.end(),1);
+					typename MeshList<THalfedge<V,H> >::iterator nhe = std::prev(halfedges.end(),1);
 					nhe->prev = it;
 					nhe->next = it->prev;
 					nhe->sink = nhe->next->prev->sink;
@@ -368,7 +593,7 @@ class Mesh
 					nhe->opposite = halfedges.end();
 
 					addFace (TFace<V,H>(nhe));
-					typename std::list<TFace<V,H> >::iterator nf = std::prev(faces.end(),1);
+					typename MeshList<TFace<V,H> >::iterator nf = std::prev(faces.end(),1);
 					nhe->face = nf;
 					nhe->next->face = nf;
 					nhe->next->next->face = nf;
@@ -377,23 +602,29 @@ class Mesh
 				} while (it != vit->outHalfedge);
 			}
 
-			std::vector< std::pair<typename std::list<TVertex<V,H> >::iterator,int> > query;
-			std::vector<int> filled_faces;
+			ScratchVector< std::pair<typename MeshList<TVertex<V,H> >::iterator,int> > query;
+			ScratchVector<int> face_offsets, face_entries;
+			groupByFace (new_vertices_faces, face_offsets, face_entries);
+			ScratchVector<char> filled (face_offsets.size(), 0);
 			for (size_t i=0; i< new_vertices_faces.size(); i++)
 			{
-				if (std::find (filled_faces.begin(), filled_faces.end(), new_vertices_faces[i].second) != filled_faces.end())
+				if (interrupted ("centre faces", i, new_vertices_faces.size(), 64)) return SUBDIVISION_STOPPED;
+				int old_face = new_vertices_faces[i].second;
+				if (filled[old_face])
 					continue;
-				query = getAllPairsWithSecond (new_vertices_faces, new_vertices_faces[i].second);
+				query.clear();
+				for (int k=face_offsets[old_face]; k<face_offsets[old_face+1]; ++k)
+					query.push_back (new_vertices_faces[face_entries[k]]);
 				assert (query.size() == 3);
 
 				addHalfedge (THalfedge<V,H>());
-				typename std::list<THalfedge<V,H> >::iterator he1 = std::prev(halfedges.end(),1);
+				typename MeshList<THalfedge<V,H> >::iterator he1 = std::prev(halfedges.end(),1);
 				addHalfedge (THalfedge<V,H>());
-				typename std::list<THalfedge<V,H> >::iterator he2 = std::prev(halfedges.end(),1);
+				typename MeshList<THalfedge<V,H> >::iterator he2 = std::prev(halfedges.end(),1);
 				addHalfedge (THalfedge<V,H>());
-				typename std::list<THalfedge<V,H> >::iterator he3 = std::prev(halfedges.end(),1);
+				typename MeshList<THalfedge<V,H> >::iterator he3 = std::prev(halfedges.end(),1);
 
-				typename std::list<THalfedge<V,H> >::iterator it = query[0].first->outHalfedge;
+				typename MeshList<THalfedge<V,H> >::iterator it = query[0].first->outHalfedge;
 				if (it->next->sink != query[1].first && it->next->sink != query[2].first)
 				{
 					it = it->opposite;
@@ -423,121 +654,436 @@ class Mesh
 				assert( he3->sink == query[0].first || he3->sink == query[1].first || he3->sink == query[2].first);
 
 				addFace (TFace<V,H>(he1));
-				typename std::list<TFace<V,H> >::iterator nf = std::prev(faces.end(),1);
+				typename MeshList<TFace<V,H> >::iterator nf = std::prev(faces.end(),1);
 				he1->face = he2->face = he3->face = nf;
-				filled_faces.push_back (new_vertices_faces[i].second);
+				filled[old_face] = 1;
 			}
 
-			for (auto it = halfedges.begin(); it!=halfedges.end(); it++)
-				updateOpposite (it);
+			if (updateOpposites() != 0) return SUBDIVISION_STOPPED;
+
+			buildOneRing();
 
 			return 0;
 		}
 
-		inline float alpha (int n)
+		// Kobbelt's sqrt(3) scheme: a vertex is inserted at the centroid of every
+		// face, each face is split into three around it and every old edge is
+		// flipped. Faces grow by 3x per level instead of 4x.
+		int sqrt3Subdivision()
 		{
-			return (3.f/8.f) + ((3.f/8.f) + (1.f/4.f)*cos(2*M_PI/n))*((3.f/8.f) + (1.f/4.f)*cos(2*M_PI/n));
+			size_t old_verts = vertices.size();
+			size_t old_halfedges = halfedges.size();
+			size_t old_faces = faces.size();
+
+			ScratchVector<Vector3f> old_positions = gatherPositions();
+			const OneRingTable& ring = oneRing();
+			ScratchVector<Vector3f> vertex_points;
+			vertex_points.reserve (old_verts);
+			for (size_t v=0; v<old_verts; ++v)
+			{
+				if (interrupted ("vertex points", v, old_verts)) return SUBDIVISION_STOPPED;
+				vertex_points.push_back (sqrt3VertexPoint (v, ring, old_positions));
+			}
+
+			ScratchVector<Vector3f> face_points;
+			face_points.reserve (old_faces);
+			for (auto it = faces.begin(); it!=faces.end(); it++)
+			{
+				if (interrupted ("face points", face_points.size(), old_faces)) return SUBDIVISION_STOPPED;
+				face_points.push_back (sqrt3FacePoint (it, old_verts + face_points.size()));
+			}
+
+			auto fit = faces.begin();
+			for (size_t f=0; f<old_faces; ++f, ++fit)
+			{
+				if (interrupted ("split faces", f, old_faces)) return SUBDIVISION_STOPPED;
+				splitFace (fit, face_points[f]);
+			}
+
+			ScratchVector<char> flipped (old_halfedges, 0);
+			auto hit = halfedges.begin();
+			for (size_t h=0; h<old_halfedges; ++h, ++hit)
+			{
+				if (interrupted ("flip edges", h, old_halfedges)) return SUBDIVISION_STOPPED;
+				if (flipped[hit->id]) continue;
+				flipped[hit->id] = flipped[hit->opposite->id] = 1;
+				flipEdge (hit);
+			}
+
+			size_t v = 0;
+			for (auto it = vertices.begin(); v<old_verts; it++, v++)
+			{
+				it->position = vertex_points[v];
+			}
+
+			buildOneRing();
+
+			return 0;
 		}
 
-		typename std::list<TVertex<V,H> >::iterator splitEdge (size_t he_id)
+		Vector3f sqrt3VertexPoint (int v, const OneRingTable& ring, const ScratchVector<Vector3f>& positions)
 		{
-			typename std::list<TVertex<V,H> >::iterator src_vertex, dst_vertex;
-			typename std::list<THalfedge<V,H> >::iterator he = std::next(halfedges.begin(),he_id);
-			typename std::list<THalfedge<V,H> >::iterator he_op = he->opposite;
+			int n = ring.valence (v);
+			float beta_n = (4.f - 2.f*cos(2*M_PI/n)) / 9.f;
 
-			src_vertex = he->prev->sink;
-			dst_vertex = he->sink;
+			Vector3f sum;
+			for (const int* pj = ring.begin (v); pj!=ring.end (v); ++pj)
+			{
+				sum += positions[*pj];
+			}
 
-			addVertex (Vertex (0.5f * (src_vertex->position + dst_vertex->position)));
-			typename std::list<TVertex<V,H> >::iterator created_vertex = std::prev(vertices.end(),1);
-			created_vertex->outHalfedge = he_op;
-			he->sink = created_vertex;
-			src_vertex->outHalfedge = he;
+			Vector3f new_pos = (1-beta_n)*positions[v];
+			new_pos.addScaled (beta_n/n, sum);
 
-			addHalfedge (Halfedge());
-			typename std::list<THalfedge<V,H> >::iterator new_he_go = std::prev(halfedges.end(),1);
-			addHalfedge (Halfedge());
-			typename std::list<THalfedge<V,H> >::iterator new_he_op = std::prev(halfedges.end(),1);
+			if (stencil_log)
+			{
+				stencil_log->beginRow (v);
+				stencil_log->addWeight (v, 1-beta_n);
+				for (const int* pj = ring.begin (v); pj!=ring.end (v); ++pj)
+					stencil_log->addWeight (*pj, beta_n/n);
+			}
 
-			new_he_go->opposite = new_he_op;
-			new_he_op->opposite = new_he_go;
+			return new_pos;
+		}
 
-			new_he_go->sink = dst_vertex;
-			new_he_op->sink = created_vertex;
+		Vector3f sqrt3FacePoint (typename MeshList<TFace<V,H> >::iterator f, int new_id)
+		{
+			Vector3f centroid;
+			if (stencil_log)
+				stencil_log->beginRow (new_id);
+
+			auto it = f->halfedge;
+			do {
+				centroid.addScaled (1.f/POLY_SIZE, it->sink->position);
+				if (stencil_log)
+					stencil_log->addWeight (it->sink->id, 1.f/POLY_SIZE);
+				it = it->next;
+			} while (it != f->halfedge);
+
+			return centroid;
+		}
 
-			new_he_go->next = he->next;
-			new_he_go->next->prev = new_he_go;
-			new_he_op->next = he_op;
+		// Splits a triangle into three around a new vertex at position.
+		typename MeshList<TVertex<V,H> >::iterator splitFace (
+				typename MeshList<TFace<V,H> >::iterator f,
+				const Vector3f& position
+		)
+		{
+			addVertex (Vertex (position));
+			typename MeshList<TVertex<V,H> >::iterator center = std::prev(vertices.end(),1);
 
-			new_he_go->prev = he;
-			new_he_op->prev = he_op->prev;
-			new_he_op->prev->next = new_he_op;
+			typename MeshList<THalfedge<V,H> >::iterator border[3], spoke_in[3], spoke_out[3];
+			border[0] = f->halfedge;
+			border[1] = border[0]->next;
+			border[2] = border[1]->next;
 
-			new_he_go->face = he->face;
-			new_he_op->face = he_op->face;
+			for (int i=0; i<3; ++i)
+			{
+				addHalfedge (Halfedge());
+				spoke_in[i] = std::prev(halfedges.end(),1);
+				addHalfedge (Halfedge());
+				spoke_out[i] = std::prev(halfedges.end(),1);
+			}
 
-			he->next = new_he_go;
-			he_op->prev = new_he_op;
-			dst_vertex->outHalfedge = new_he_op;
+			for (int i=0; i<3; ++i)
+			{
+				// Triangle i: border[i] (x -> y), spoke_in[i] (y -> center), spoke_out[i] (center -> x).
+				typename MeshList<TFace<V,H> >::iterator face = f;
+				if (i > 0)
+				{
+					addFace (TFace<V,H>(border[i]));
+					face = std::prev(faces.end(),1);
+				}
 
-			return created_vertex;
+				spoke_in[i]->sink = center;
+				spoke_out[i]->sink = border[(i+2)%3]->sink;
+
+				border[i]->next = spoke_in[i];
+				spoke_in[i]->next = spoke_out[i];
+				spoke_out[i]->next = border[i];
+				border[i]->prev = spoke_out[i];
+				spoke_in[i]->prev = border[i];
+				spoke_out[i]->prev = spoke_in[i];
+
+				spoke_in[i]->opposite = spoke_out[(i+1)%3];
+				spoke_out[(i+1)%3]->opposite = spoke_in[i];
+
+				border[i]->face = spoke_in[i]->face = spoke_out[i]->face = face;
+			}
+
+			f->halfedge = border[0];
+			center->outHalfedge = spoke_out[0];
+
+			return center;
 		}
 
-		typename std::list<TVertex<V,H> >::iterator loopSplitEdge (size_t he_id)
+		// Replaces the edge shared by triangles (a,b,c) and (b,a,d) with the
+		// edge joining c and d. Both halfedges and faces are reused.
+		void flipEdge (typename MeshList<THalfedge<V,H> >::iterator he)
 		{
-			typename std::list<TVertex<V,H> >::iterator src_vertex, dst_vertex, far_vertex1, far_vertex2;
-			typename std::list<THalfedge<V,H> >::iterator he = std::next(halfedges.begin(),he_id);
-			typename std::list<THalfedge<V,H> >::iterator he_op = he->opposite;
+			typename MeshList<THalfedge<V,H> >::iterator he_op = he->opposite;
+			typename MeshList<THalfedge<V,H> >::iterator he_next = he->next, he_prev = he->prev;
+			typename MeshList<THalfedge<V,H> >::iterator op_next = he_op->next, op_prev = he_op->prev;
+
+			typename MeshList<TVertex<V,H> >::iterator a = he_op->sink, b = he->sink;
+			typename MeshList<TVertex<V,H> >::iterator c = he_next->sink, d = op_next->sink;
+
+			// (a, d, c): op_next, he, he_prev
+			he->sink = c;
+			op_next->next = he; he->prev = op_next;
+			he->next = he_prev; he_prev->prev = he;
+			he_prev->next = op_next; op_next->prev = he_prev;
+			op_next->face = he->face;
+
+			// (d, b, c): op_prev, he_next, he_op
+			he_op->sink = d;
+			op_prev->next = he_next; he_next->prev = op_prev;
+			he_next->next = he_op; he_op->prev = he_next;
+			he_op->next = op_prev; op_prev->prev = he_op;
+			he_next->face = he_op->face;
+
+			he->face->halfedge = he;
+			he_op->face->halfedge = he_op;
+			a->outHalfedge = op_next;
+			b->outHalfedge = he_next;
+		}
 
-			src_vertex = he->prev->sink;
-			dst_vertex = he->sink;
+		// One level of the given scheme. With a context set, the level is
+		// abandoned when the context asks to stop: the links of the previous
+		// level are restored and SUBDIVISION_STOPPED is returned. Meshes that
+		// are open, have unreferenced vertices or non-manifold vertices are
+		// refused with -1.
+		int subdivide (SubdivisionScheme scheme)
+		{
+			if (!isClosedManifold())
+			{
+				std::cout << "Subdivision needs a closed manifold mesh without unreferenced vertices." << std::endl;
+				return -1;
+			}
 
-			far_vertex1 = he->nextOverLine()->sink;
-			far_vertex2 = he_op->nextOverLine()->sink;
+			if (!context)
+				return subdivideLevel (scheme);
 
-			addVertex (Vertex ((3.f/8.f) * (src_vertex->position + dst_vertex->position)
-						+ (1.f/8.f) * (far_vertex1->position + far_vertex2->position)));
+			LevelSnapshot saved;
+			saveLevel (saved);
+			size_t stencil_rows = stencil_log ? stencil_log->size() : 0;
 
-			typename std::list<TVertex<V,H> >::iterator created_vertex = std::prev(vertices.end(),1);
-			created_vertex->outHalfedge = he_op;
-			he->sink = created_vertex;
-			src_vertex->outHalfedge = he;
+			int result = subdivideLevel (scheme);
+			if (result == SUBDIVISION_STOPPED)
+			{
+				restoreLevel (saved);
+				if (stencil_log)
+					stencil_log->resize (stencil_rows);
+			}
 
-			addHalfedge (Halfedge());
-			typename std::list<THalfedge<V,H> >::iterator new_he_go = std::prev(halfedges.end(),1);
-			addHalfedge (Halfedge());
-			typename std::list<THalfedge<V,H> >::iterator new_he_op = std::prev(halfedges.end(),1);
+			return result;
+		}
 
-			new_he_go->opposite = new_he_op;
-			new_he_op->opposite = new_he_go;
+		// Subdivides up to max_levels times and returns the number of levels
+		// done. With a deadline in the context, a level is only started when
+		// the time per face of the last level, times the current face count,
+		// fits in the remaining time; the per-face cost is assumed to keep
+		// growing as it did between the last two levels. A level the
+		// deadline still interrupts is undone.
+		int subdivideWithin (SubdivisionScheme scheme, int max_levels)
+		{
+			double rate = -1, previous_rate = -1;
+			int level = 0;
+			for (; level<max_levels; ++level)
+			{
+				size_t num_faces = faces.size();
+				if (context && rate > 0)
+				{
+					double growth = (previous_rate > 0) ? std::max (1.0, rate/previous_rate) : 1.0;
+					if (rate*growth*num_faces > context->remainingSeconds())
+						break;
+				}
 
-			new_he_go->sink = dst_vertex;
-			new_he_op->sink = created_vertex;
+				ExecutionContext::Clock::time_point start = ExecutionContext::Clock::now();
+				if (subdivide (scheme) != 0)
+					break;
 
-			new_he_go->next = he->next;
-			new_he_go->next->prev = new_he_go;
-			new_he_op->next = he_op;
+				previous_rate = rate;
+				rate = std::chrono::duration<double> (ExecutionContext::Clock::now() - start).count() / num_faces;
+			}
 
-			new_he_go->prev = he;
-			new_he_op->prev = he_op->prev;
-			new_he_op->prev->next = new_he_op;
+			return level;
+		}
 
-			new_he_go->face = he->face;
-			new_he_op->face = he_op->face;
+		// Links of every element by id. A level only appends vertices and
+		// halfedges and rebuilds the face list, so truncating the lists and
+		// relinking undoes it in linear time; no edge lookup is needed.
+		struct LevelSnapshot
+		{
+			ScratchVector<Vector3f> positions;
+			ScratchVector<int> out_halfedges;
+			// sink, face, next, prev and opposite of every halfedge.
+			ScratchVector<int> links;
+			ScratchVector<int> face_halfedges;
+		};
+
+		void saveLevel (LevelSnapshot& saved)
+		{
+			saved.positions = gatherPositions();
+			saved.out_halfedges.reserve (vertices.size());
+			for (auto it = vertices.begin(); it!=vertices.end(); it++)
+				saved.out_halfedges.push_back (it->outHalfedge->id);
+			saved.links.reserve (5*halfedges.size());
+			for (auto it = halfedges.begin(); it!=halfedges.end(); it++)
+			{
+				saved.links.push_back (it->sink->id);
+				saved.links.push_back (it->face->id);
+				saved.links.push_back (it->next->id);
+				saved.links.push_back (it->prev->id);
+				saved.links.push_back (it->opposite->id);
+			}
+			saved.face_halfedges.reserve (faces.size());
+			for (auto it = faces.begin(); it!=faces.end(); it++)
+				saved.face_halfedges.push_back (it->halfedge->id);
+		}
 
-			he->next = new_he_go;
-			he_op->prev = new_he_op;
-			dst_vertex->outHalfedge = new_he_op;
+		void restoreLevel (const LevelSnapshot& saved)
+		{
+			vertices.erase (std::next (vertices.begin(), saved.positions.size()), vertices.end());
+			halfedges.erase (std::next (halfedges.begin(), saved.links.size()/5), halfedges.end());
 
-			return created_vertex;
+			ScratchVector<typename MeshList<TVertex<V,H> >::iterator> vertex_its;
+			vertex_its.reserve (vertices.size());
+			for (auto it = vertices.begin(); it!=vertices.end(); it++)
+				vertex_its.push_back (it);
+			ScratchVector<typename MeshList<THalfedge<V,H> >::iterator> halfedge_its;
+			halfedge_its.reserve (halfedges.size());
+			for (auto it = halfedges.begin(); it!=halfedges.end(); it++)
+				halfedge_its.push_back (it);
+
+			faces.clear();
+			ScratchVector<typename MeshList<TFace<V,H> >::iterator> face_its;
+			face_its.reserve (saved.face_halfedges.size());
+			for (size_t f=0; f<saved.face_halfedges.size(); ++f)
+			{
+				addFace (TFace<V,H> (halfedge_its[saved.face_halfedges[f]]));
+				face_its.push_back (std::prev (faces.end(), 1));
+			}
+
+			for (size_t v=0; v<vertex_its.size(); ++v)
+			{
+				vertex_its[v]->position = saved.positions[v];
+				vertex_its[v]->outHalfedge = halfedge_its[saved.out_halfedges[v]];
+			}
+			for (size_t h=0; h<halfedge_its.size(); ++h)
+			{
+				const int* link = &saved.links[5*h];
+				halfedge_its[h]->sink = vertex_its[link[0]];
+				halfedge_its[h]->face = face_its[link[1]];
+				halfedge_its[h]->next = halfedge_its[link[2]];
+				halfedge_its[h]->prev = halfedge_its[link[3]];
+				halfedge_its[h]->opposite = halfedge_its[link[4]];
+			}
+		}
+
+		int subdivideLevel (SubdivisionScheme scheme)
+		{
+			switch (scheme)
+			{
+				case LOOP: return loopSubdivision();
+				case BUTTERFLY: return butterflySubdivision();
+				case SQRT3: return sqrt3Subdivision();
+			}
+			return -1;
+		}
+
+		// Reports progress through the context every 'chunk' elements of a
+		// phase, and tells whether the context asks to stop.
+		bool interrupted (const char* phase, size_t done, size_t total, size_t chunk = 4096)
+		{
+			if (!context || done % chunk != 0)
+				return false;
+			context->progress (phase, (double)done / total);
+			return context->stopRequested();
+		}
+
+		inline float alpha (int n)
+		{
+			return loopAlpha (n);
+		}
+
+		// One halfedge per undirected edge, in the order the edges are split.
+		ScratchVector<typename MeshList<THalfedge<V,H> >::iterator> edgesToSplit ()
+		{
+			ScratchVector<typename MeshList<THalfedge<V,H> >::iterator> result;
+			ScratchVector<char> seen (halfedges.size(), 0);
+			for (auto it = halfedges.begin(); it!=halfedges.end(); it++)
+			{
+				if (seen[it->id]) continue;
+				seen[it->id] = seen[it->opposite->id] = 1;
+				result.push_back (it);
+			}
+			return result;
+		}
+
+		// The point rules below read the unrefined mesh: they are evaluated for
+		// every vertex and edge before any edge is split, so the result does not
+		// depend on the order in which edges are visited.
+
+		Vector3f loopVertexPoint (int v, const OneRingTable& ring, const ScratchVector<Vector3f>& positions)
+		{
+			int n = ring.valence (v);
+			float alpha_n = alpha (n);
+
+			Vector3f sum;
+			for (const int* pj = ring.begin (v); pj!=ring.end (v); ++pj)
+			{
+				sum += positions[*pj];
+			}
+
+			Vector3f new_pos = alpha_n*positions[v];
+			new_pos.addScaled ((1-alpha_n)/n, sum);
+
+			if (stencil_log)
+			{
+				stencil_log->beginRow (v);
+				stencil_log->addWeight (v, alpha_n);
+				for (const int* pj = ring.begin (v); pj!=ring.end (v); ++pj)
+					stencil_log->addWeight (*pj, (1-alpha_n)/n);
+			}
+
+			return new_pos;
 		}
 
-		typename std::list<TVertex<V,H> >::iterator butterflySplitEdge (size_t he_id)
+		Vector3f loopEdgePoint (typename MeshList<THalfedge<V,H> >::iterator he, int new_id)
 		{
-			typename std::list<TVertex<V,H> >::iterator src_vertex, dst_vertex, far_vertex1, far_vertex2,
+			typename MeshList<TVertex<V,H> >::iterator src_vertex, dst_vertex, far_vertex1, far_vertex2;
+			typename MeshList<THalfedge<V,H> >::iterator he_op = he->opposite;
+
+			src_vertex = he->prev->sink;
+			dst_vertex = he->sink;
+
+			far_vertex1 = he->next->sink;
+			far_vertex2 = he_op->next->sink;
+
+			Vector3f new_vertex_position;
+			new_vertex_position.addScaled (3.f/8.f, src_vertex->position)
+				.addScaled (3.f/8.f, dst_vertex->position)
+				.addScaled (1.f/8.f, far_vertex1->position)
+				.addScaled (1.f/8.f, far_vertex2->position);
+
+			if (stencil_log)
+			{
+				stencil_log->beginRow (new_id);
+				stencil_log->addWeight (src_vertex->id, 3.f/8.f);
+				stencil_log->addWeight (dst_vertex->id, 3.f/8.f);
+				stencil_log->addWeight (far_vertex1->id, 1.f/8.f);
+				stencil_log->addWeight (far_vertex2->id, 1.f/8.f);
+			}
+
+			return new_vertex_position;
+		}
+
+		Vector3f butterflyEdgePoint (typename MeshList<THalfedge<V,H> >::iterator he, int new_id)
+		{
+			typename MeshList<TVertex<V,H> >::iterator src_vertex, dst_vertex, far_vertex1, far_vertex2,
 					 wing_vertex1, wing_vertex2, wing_vertex3, wing_vertex4;
-			typename std::list<THalfedge<V,H> >::iterator he = std::next(halfedges.begin(),he_id);
-			typename std::list<THalfedge<V,H> >::iterator he_op = he->opposite;
+			typename MeshList<THalfedge<V,H> >::iterator he_op = he->opposite;
 
 			src_vertex = he->prev->sink;
 			dst_vertex = he->sink;
@@ -545,27 +1091,58 @@ class Mesh
 			far_vertex1 = he->next->sink;
 			far_vertex2 = he_op->next->sink;
 
-			wing_vertex1 = he->nextOverLine()->opposite->nextOverLine()->sink;
-			wing_vertex2 = he->prevOverLine()->opposite->nextOverLine()->sink;
-			wing_vertex3 = he_op->nextOverLine()->opposite->nextOverLine()->sink;
-			wing_vertex4 = he_op->prevOverLine()->opposite->nextOverLine()->sink;
+			wing_vertex1 = he->next->opposite->next->sink;
+			wing_vertex2 = he->prev->opposite->next->sink;
+			wing_vertex3 = he_op->next->opposite->next->sink;
+			wing_vertex4 = he_op->prev->opposite->next->sink;
+
+			Vector3f new_vertex_position;
+			new_vertex_position.addScaled (1.f/2.f, src_vertex->position)
+				.addScaled (1.f/2.f, dst_vertex->position)
+				.addScaled (1.f/8.f, far_vertex1->position)
+				.addScaled (1.f/8.f, far_vertex2->position)
+				.addScaled (-1.f/16.f, wing_vertex1->position)
+				.addScaled (-1.f/16.f, wing_vertex2->position)
+				.addScaled (-1.f/16.f, wing_vertex3->position)
+				.addScaled (-1.f/16.f, wing_vertex4->position);
+
+			if (stencil_log)
+			{
+				stencil_log->beginRow (new_id);
+				stencil_log->addWeight (src_vertex->id, 1.f/2.f);
+				stencil_log->addWeight (dst_vertex->id, 1.f/2.f);
+				stencil_log->addWeight (far_vertex1->id, 1.f/8.f);
+				stencil_log->addWeight (far_vertex2->id, 1.f/8.f);
+				stencil_log->addWeight (wing_vertex1->id, -1.f/16.f);
+				stencil_log->addWeight (wing_vertex2->id, -1.f/16.f);
+				stencil_log->addWeight (wing_vertex3->id, -1.f/16.f);
+				stencil_log->addWeight (wing_vertex4->id, -1.f/16.f);
+			}
 
-			Vector3f new_vertex_position = (1.f/2.f) * (src_vertex->position + dst_vertex->position);
-			new_vertex_position = new_vertex_position + (1.f/8.f) * (far_vertex1->position + far_vertex2->position);
-			new_vertex_position = new_vertex_position - (1.f/16.f) * (wing_vertex1->position + wing_vertex2->position +
-							wing_vertex3->position + wing_vertex4->position);
+			return new_vertex_position;
+		}
 
-			addVertex (Vertex (new_vertex_position));
+		typename MeshList<TVertex<V,H> >::iterator splitEdge (
+				typename MeshList<THalfedge<V,H> >::iterator he,
+				const Vector3f& position
+		)
+		{
+			typename MeshList<TVertex<V,H> >::iterator src_vertex, dst_vertex;
+			typename MeshList<THalfedge<V,H> >::iterator he_op = he->opposite;
 
-			typename std::list<TVertex<V,H> >::iterator created_vertex = std::prev(vertices.end(),1);
+			src_vertex = he->prev->sink;
+			dst_vertex = he->sink;
+
+			addVertex (Vertex (position));
+			typename MeshList<TVertex<V,H> >::iterator created_vertex = std::prev(vertices.end(),1);
 			created_vertex->outHalfedge = he_op;
 			he->sink = created_vertex;
 			src_vertex->outHalfedge = he;
 
 			addHalfedge (Halfedge());
-			typename std::list<THalfedge<V,H> >::iterator new_he_go = std::prev(halfedges.end(),1);
+			typename MeshList<THalfedge<V,H> >::iterator new_he_go = std::prev(halfedges.end(),1);
 			addHalfedge (Halfedge());
-			typename std::list<THalfedge<V,H> >::iterator new_he_op = std::prev(halfedges.end(),1);
+			typename MeshList<THalfedge<V,H> >::iterator new_he_op = std::prev(halfedges.end(),1);
 
 			new_he_go->opposite = new_he_op;
 			new_he_op->opposite = new_he_go;
@@ -591,21 +1168,55 @@ class Mesh
 			return created_vertex;
 		}
 
-		void updateOpposite (typename std::list<THalfedge<V,H> >::iterator he)
+		// Links every halfedge to the one running the other way along its
+		// edge, looked up by (source, sink) ids.
+		int updateOpposites ()
 		{
-			int founds = 0;
-			for (auto it=halfedges.begin(); it!=halfedges.end(); it++)
+			ScratchMap<uint64_t, typename MeshList<THalfedge<V,H> >::iterator> by_edge;
+			by_edge.reserve (halfedges.size());
+			for (auto it = halfedges.begin(); it!=halfedges.end(); it++)
+				by_edge[edgeKey (it->prev->sink->id, it->sink->id)] = it;
+
+			size_t done = 0;
+			for (auto it = halfedges.begin(); it!=halfedges.end(); it++)
 			{
-				if (he->sink == it->prev->sink && it->sink == he->prev->sink)
-				{
-					he->opposite = it;
-					it->opposite = he;
-					founds++;
-				}
+				if (interrupted ("opposites", done++, halfedges.size())) return SUBDIVISION_STOPPED;
+				auto found = by_edge.find (edgeKey (it->sink->id, it->prev->sink->id));
+				if (found == by_edge.end()) continue;
+				it->opposite = found->second;
+				found->second->opposite = it;
 			}
+			return 0;
 		}
 
-		void destroyFace (typename std::list<TFace<V,H> >::iterator f_id)
+		static uint64_t edgeKey (int source, int sink)
+		{
+			return ((uint64_t)(uint32_t)source << 32) | (uint32_t)sink;
+		}
+
+		// Indices into pairs grouped by their face id: the entries of face f
+		// are entries[offsets[f]] .. entries[offsets[f+1]-1], in pair order.
+		static void groupByFace (
+				const ScratchVector< std::pair<typename MeshList<TVertex<V,H> >::iterator,int> >& pairs,
+				ScratchVector<int>& offsets,
+				ScratchVector<int>& entries
+		)
+		{
+			int num_faces = 0;
+			for (size_t i=0; i<pairs.size(); ++i)
+				num_faces = std::max (num_faces, pairs[i].second + 1);
+			offsets.assign (num_faces + 1, 0);
+			for (size_t i=0; i<pairs.size(); ++i)
+				offsets[pairs[i].second + 1]++;
+			for (int f=0; f<num_faces; ++f)
+				offsets[f+1] += offsets[f];
+			entries.resize (pairs.size());
+			ScratchVector<int> fill (offsets.begin(), offsets.end() - 1);
+			for (size_t i=0; i<pairs.size(); ++i)
+				entries[fill[pairs[i].second]++] = i;
+		}
+
+		void destroyFace (typename MeshList<TFace<V,H> >::iterator f_id)
 		{
 			for (auto hit = halfedges.begin(); hit != halfedges.end(); hit++)
 			{
@@ -618,23 +1229,25 @@ class Mesh
 			faces.erase (f_id);
 		}
 
-		std::vector<typename std::list<TVertex<V,H> >::iterator> getOneRing(
-				typename std::list<TVertex<V,H> >::iterator v
-		)
-		{
-			std::vector<typename std::list<TVertex<V,H> >::iterator > oneRing;
-			auto it = v->outHalfedge;
-			do{
-				oneRing.push_back (it->sink);
-				it = it->prev->opposite;
-			} while (it != v->outHalfedge);
+		MeshList<TVertex<V,H> > vertices;
+		MeshList<THalfedge<V,H> > halfedges;
+		MeshList<TFace<V,H> > faces;
 
-			return oneRing;
-		}
+		// When set, every vertex rule applied by the subdivision schemes is
+		// appended here, so the refinement can be replayed on other positions.
+		StencilTable* stencil_log;
+
+		// Kept current by generateMesh and every subdivision level.
+		OneRingTable one_ring;
+
+		// When set, subdivision reports progress to it and stops when asked.
+		ExecutionContext* context;
 
-		std::list<TVertex<V,H> > vertices;
-		std::list<THalfedge<V,H> > halfedges;
-		std::list<TFace<V,H> > faces;
+		// When set, Loop and butterfly levels call it as soon as the refined
+		// positions are known, before any topology is rebuilt: the old
+		// vertices, then one point per split edge, in final vertex order. A
+		// level the context stops afterwards has still reported them.
+		std::function<void (const ScratchVector<Vector3f>& vertex_points, const ScratchVector<Vector3f>& edge_points)> positions_ready;
 
 		typedef TVertex<V,H> Vertex;
 		typedef THalfedge<V,H> Halfedge;
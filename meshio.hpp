@@ -3,12 +3,17 @@
 
 #include "linalgebra.hpp"
 #include "mesh.hpp"
+#include "weld.hpp"
+#include "rangecoder.hpp"
 
 #include <iostream>
 #include <sstream>
 #include <string>
 #include <vector>
 #include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
 
 inline std::vector<std::string> split( 
 		const std::string& str, 
@@ -24,9 +29,28 @@ inline std::vector<std::string> split(
 	return internal;
 }
 
+// Reports progress through the context every 4096 records, and tells
+// whether the context asks to stop.
+inline bool recordInterrupted (ExecutionContext* context, const char* phase, size_t record, double fraction)
+{
+	if (!context || record % 4096 != 0)
+		return false;
+	context->progress (phase, fraction);
+	return context->stopRequested();
+}
+
+// The same for a stream of size_bytes being parsed; the stream position is
+// only queried on reporting records, since tellg() is not free.
+inline bool recordInterrupted (ExecutionContext* context, const char* phase, size_t record, std::istream& fs, double size_bytes)
+{
+	if (!context || record % 4096 != 0)
+		return false;
+	return recordInterrupted (context, phase, record, std::max<double> (0, fs.tellg()) / size_bytes);
+}
+
 enum MeshFileType
 {
-	OBJ, OFF
+	OBJ, OFF, POBJ, SUBZ
 };
 
 template<MeshFileType FileType>
@@ -53,10 +77,14 @@ struct MeshIO
 template<>
 struct MeshIO<MeshFileType::OBJ>
 {
+	// Appends to any vector-like containers; the StandardMesh loaders pass
+	// ScratchVectors so that parsing shows up in allocation profiles.
+	template <typename VertexVector, typename IndexVector>
 	static int loadMesh(
 			std::string path, 
-			std::vector<Vector3f>& vertices, 
-			std::vector<int>& indices
+			VertexVector& vertices, 
+			IndexVector& indices,
+			ExecutionContext* context = NULL
 	)
 	{
 		std::ifstream fs;
@@ -66,13 +94,21 @@ struct MeshIO<MeshFileType::OBJ>
 			std::cout << "Mesh file \"" << path << "\" could not be loaded." << std::endl;
 			return -1;
 		}
-		std::vector<Vector3f> single_normals;
-		std::vector<int> normal_indices;
-		std::vector<Vector2f> single_uvs;
-		std::vector<int> uvs_indices;
+		fs.seekg (0, std::ifstream::end);
+		double file_size = std::max<double> (1, fs.tellg());
+		fs.seekg (0, std::ifstream::beg);
+		size_t records = 0;
+		ScratchVector<Vector3f> single_normals;
+		ScratchVector<Vector2f> single_uvs;
 
 		while( !fs.eof() )
 		{
+			if (recordInterrupted (context, "load", records++, fs, file_size))
+			{
+				std::cout << "Loading \"" << path << "\" was cancelled." << std::endl;
+				return -1;
+			}
+
 			std::string type;
 			fs >> type;
 			if (type[0] == '#')
@@ -118,11 +154,11 @@ struct MeshIO<MeshFileType::OBJ>
 		return 0;
 	}
 
-	static int loadMesh (std::string path, StandardMesh& mesh)
+	static int loadMesh (std::string path, StandardMesh& mesh, ExecutionContext* context = NULL)
 	{
-		std::vector<Vector3f> raw_vertices;
-		std::vector<int> indices;
-		if (loadMesh (path, raw_vertices, indices) < 0)
+		ScratchVector<Vector3f> raw_vertices;
+		ScratchVector<int> indices;
+		if (loadMesh (path, raw_vertices, indices, context) < 0)
 			return -1;
 
 		mesh.generateMesh (raw_vertices, indices);
@@ -130,31 +166,725 @@ struct MeshIO<MeshFileType::OBJ>
 		return 0;
 	}
 
-	static int writeMesh (std::string path, StandardMesh& mesh)
+	// Loads and welds vertices closer than weld_tolerance before the
+	// half-edge topology is built, so face soups become connected meshes.
+	// The context sees the parse as the "load" phase, as without welding.
+	static int loadMesh (std::string path, StandardMesh& mesh, float weld_tolerance, ExecutionContext* context = NULL)
+	{
+		ScratchVector<Vector3f> raw_vertices;
+		ScratchVector<int> indices;
+		if (loadMesh (path, raw_vertices, indices, context) < 0)
+			return -1;
+
+		weldVertices (raw_vertices, indices, weld_tolerance, POLY_SIZE);
+		mesh.generateMesh (raw_vertices, indices);
+
+		return 0;
+	}
+
+	static int writeMesh (std::string path, StandardMesh& mesh, ExecutionContext* context = NULL)
 	{
 		std::ofstream fs;
 		fs.open (path, std::ofstream::out);
 
+		return writeMesh (fs, mesh, context);
+	}
+
+	// A write the context stops returns -1 and leaves a truncated file.
+	static int writeMesh (std::ostream& fs, StandardMesh& mesh, ExecutionContext* context = NULL)
+	{
+		const double total = std::max<size_t> (1, mesh.vertices.size() + mesh.faces.size());
+		size_t records = 0;
+
 		for (auto i=mesh.vertices.begin(); i!=mesh.vertices.end(); i++)
 		{
-			fs << "v " << i->position << std::endl;
+			if (recordInterrupted (context, "write", records, records / total)) return -1;
+			records++;
+			fs << "v " << i->position << '\n';
+		}
+
+		for (auto i=mesh.faces.begin(); i!=mesh.faces.end(); i++)
+		{
+			if (recordInterrupted (context, "write", records, records / total)) return -1;
+			records++;
+			writeFace (fs, *i);
+		}
+		fs.flush();
+
+		return 0;
+	}
+
+	// The face records alone, for output whose vertex block was streamed
+	// while the mesh was refined.
+	static int writeFaces (std::ostream& fs, StandardMesh& mesh)
+	{
+		for (auto i=mesh.faces.begin(); i!=mesh.faces.end(); i++)
+			writeFace (fs, *i);
+		fs.flush();
+
+		return 0;
+	}
+
+	static void writeFace (std::ostream& fs, const StandardMesh::Face& face)
+	{
+		fs << "f ";
+		auto he = face.halfedge;
+		auto it = he;
+		do {
+			fs << it->sink->id+1 << " ";
+			it = it->next;
+		} while (it != he);
+		fs << '\n';
+	}
+
+	// Writes packed xyz positions and POLY_SIZE indices per face.
+	static int writeMesh (
+			std::ostream& fs,
+			const std::vector<float>& positions,
+			const std::vector<int>& indices
+	)
+	{
+		for (size_t i=0; i+2<positions.size(); i+=3)
+		{
+			fs << "v " << positions[i] << " " << positions[i+1] << " " << positions[i+2] << " \n";
 		}
 
+		for (size_t i=0; i<indices.size(); i+=POLY_SIZE)
+		{
+			fs << "f ";
+			for (int k=0; k<POLY_SIZE; ++k)
+				fs << indices[i+k]+1 << " ";
+			fs << '\n';
+		}
+		fs.flush();
+
+		return 0;
+	}
+};
+
+// Progressive OBJ: the base mesh followed by one block per subdivision
+// level. Every scheme appends new vertices after the existing ones, so a
+// level only stores its new vertices, the existing vertices whose position
+// changed ("vu", approximating schemes only) and its face list:
+//
+//   l 0
+//   v x y z          base vertices
+//   f a b c          base faces
+//   l 1
+//   vu i x y z       updated position of vertex i (1-based)
+//   v x y z          vertices added at this level
+//   f a b c          faces of this level
+//
+// Readers can stop at any "l" line and hold a complete mesh.
+template<>
+struct MeshIO<MeshFileType::POBJ>
+{
+	// Appends the current state of mesh as the given level, produced by
+	// scheme from the previous one. num_written counts the vertices already
+	// in the stream and is updated. Only butterfly keeps the positions of
+	// existing vertices; after the other schemes every one of them is
+	// rewritten, so no copy of the previous positions is needed.
+	static int writeLevel (
+			std::ostream& fs,
+			StandardMesh& mesh,
+			int level,
+			SubdivisionScheme scheme,
+			size_t& num_written
+	)
+	{
+		fs << "l " << level << '\n';
+
+		size_t id = 0;
+		for (auto i=mesh.vertices.begin(); i!=mesh.vertices.end(); i++, id++)
+		{
+			if (id >= num_written)
+				fs << "v " << i->position << '\n';
+			else if (scheme != BUTTERFLY)
+				fs << "vu " << id+1 << " " << i->position << '\n';
+		}
+		num_written = mesh.vertices.size();
+
 		for (auto i=mesh.faces.begin(); i!=mesh.faces.end(); i++)
 		{
 			fs << "f ";
-			auto he = i->halfedge;
-			auto it = he;
+			auto it = i->halfedge;
 			do {
-//				std::cout << it->face->id << " " << he->id << " " << i->id << std::endl;
 				fs << it->sink->id+1 << " ";
 				it = it->next;
-			} while (it != he);
-			fs << std::endl;
+			} while (it != i->halfedge);
+			fs << '\n';
+		}
+		fs.flush();
+
+		return 0;
+	}
+
+	// Reads levels up to and including max_level (all levels if negative).
+	// Returns the last level read.
+	static int loadMesh (
+			std::string path,
+			std::vector<Vector3f>& vertices,
+			std::vector<int>& indices,
+			int max_level = -1
+	)
+	{
+		std::ifstream fs;
+		fs.open (path, std::ifstream::in);
+		if(!fs)
+		{
+			std::cout << "Mesh file \"" << path << "\" could not be loaded." << std::endl;
+			return -1;
+		}
+
+		int level = -1;
+		std::string type;
+		while (fs >> type)
+		{
+			if (type[0] == '#')
+			{
+				std::getline(fs,type);
+			}
+			else if (type == "l")
+			{
+				int next_level;
+				fs >> next_level;
+				if (max_level >= 0 && next_level > max_level)
+					break;
+				level = next_level;
+				indices.clear();
+			}
+			else if (type == "v")
+			{
+				Vector3f new_vertex;
+				fs >> new_vertex[0] >> new_vertex[1] >> new_vertex[2];
+				vertices.push_back (new_vertex);
+			}
+			else if (type == "vu")
+			{
+				size_t id;
+				fs >> id;
+				if (id < 1 || id > vertices.size())
+				{
+					std::cout << "Invalid vertex update in \"" << path << "\"." << std::endl;
+					return -1;
+				}
+				fs >> vertices[id-1][0] >> vertices[id-1][1] >> vertices[id-1][2];
+			}
+			else if (type == "f")
+			{
+				for (int i=0; i<POLY_SIZE; ++i)
+				{
+					int index;
+					fs >> index;
+					indices.push_back (index-1);
+				}
+			}
+		}
+
+		return level;
+	}
+
+	static int loadMesh (std::string path, StandardMesh& mesh, int max_level = -1)
+	{
+		std::vector<Vector3f> raw_vertices;
+		std::vector<int> indices;
+		int level = loadMesh (path, raw_vertices, indices, max_level);
+		if (level < 0)
+			return -1;
+
+		mesh.generateMesh (raw_vertices, indices);
+
+		return level;
+	}
+};
+
+// Compressed triangle meshes.
+//
+//   char[4]  "SUBZ"
+//   uint32   num_vertices, num_faces
+//   uint8    position bits, flags (1: faces stored as 1-to-4 groups)
+//   float    bounding box min[3], extent[3]
+//   range-coded connectivity, then range-coded positions
+//
+// Faces are reordered breadth-first and vertices renumbered by first use,
+// so most indices are either "the next new vertex" (one bit) or a short
+// distance back. Meshes produced by a 1-to-4 split are detected and
+// stored one parent triangle at a time: the three midpoints of the centre
+// child and the three corners, six indices for four faces. Positions are
+// quantised to the bounding box and predicted from the average of their
+// already decoded neighbours.
+template<>
+struct MeshIO<MeshFileType::SUBZ>
+{
+	static int writeMesh (std::string path, StandardMesh& mesh, int bits = 16)
+	{
+		std::vector<Vector3f> vertices;
+		std::vector<int> indices (mesh.faces.size()*POLY_SIZE);
+		vertices.reserve (mesh.vertices.size());
+		for (auto it = mesh.vertices.begin(); it!=mesh.vertices.end(); it++)
+			vertices.push_back (it->position);
+		mesh.exportIndices (indices.data());
+
+		return writeMesh (path, vertices, indices, bits);
+	}
+
+	// Packed xyz positions and POLY_SIZE indices per face, as produced by
+	// patch and blocked refinement.
+	static int writeMesh (std::string path, const std::vector<float>& positions, const std::vector<int>& indices, int bits = 16)
+	{
+		std::vector<Vector3f> vertices;
+		vertices.reserve (positions.size()/3);
+		for (size_t i=0; i+2<positions.size(); i+=3)
+			vertices.push_back (Vector3f (positions[i], positions[i+1], positions[i+2]));
+
+		return writeMesh (path, vertices, indices, bits);
+	}
+
+	static int writeMesh (std::string path, const std::vector<Vector3f>& vertices, const std::vector<int>& indices, int bits = 16)
+	{
+		std::vector<uint8_t> data;
+		if (encode (vertices, indices, bits, data) < 0)
+			return -1;
+
+		std::ofstream fs (path, std::ofstream::out | std::ofstream::binary);
+		if (!fs)
+		{
+			std::cout << "Output file \"" << path << "\" could not be opened." << std::endl;
+			return -1;
+		}
+		fs.write (reinterpret_cast<const char*>(data.data()), data.size());
+
+		return fs ? 0 : -1;
+	}
+
+	static int loadMesh (
+			std::string path,
+			std::vector<Vector3f>& vertices,
+			std::vector<int>& indices
+	)
+	{
+		std::ifstream fs (path, std::ifstream::in | std::ifstream::binary);
+		if(!fs)
+		{
+			std::cout << "Mesh file \"" << path << "\" could not be loaded." << std::endl;
+			return -1;
+		}
+		std::vector<uint8_t> data ((std::istreambuf_iterator<char>(fs)), std::istreambuf_iterator<char>());
+
+		if (decode (data.data(), data.size(), vertices, indices) < 0)
+		{
+			std::cout << "Mesh file \"" << path << "\" is not a valid SUBZ file." << std::endl;
+			return -1;
+		}
+
+		return 0;
+	}
+
+	static int loadMesh (std::string path, StandardMesh& mesh)
+	{
+		std::vector<Vector3f> raw_vertices;
+		std::vector<int> indices;
+		if (loadMesh (path, raw_vertices, indices) < 0)
+			return -1;
+
+		mesh.generateMesh (raw_vertices, indices);
+
+		return 0;
+	}
+
+	static int encode (
+			const std::vector<Vector3f>& vertices,
+			const std::vector<int>& indices,
+			int bits,
+			std::vector<uint8_t>& out
+	)
+	{
+		if (bits < 1 || bits > 30 || indices.size() % POLY_SIZE != 0)
+			return -1;
+
+		const uint32_t num_vertices = vertices.size();
+		const uint32_t num_faces = indices.size() / POLY_SIZE;
+
+		std::vector<int> stream;
+		uint8_t flags = groupedOrder (num_vertices, indices, stream) ? 1 : 0;
+		if (!flags)
+			faceOrder (num_vertices, indices, stream);
+
+		Vector3f lo, extent;
+		boundingBox (vertices, lo, extent);
+
+		out.clear();
+		out.reserve (38 + 2*indices.size() + 3*vertices.size());
+		putBytes (out, "SUBZ", 4);
+		putBytes (out, &num_vertices, 4);
+		putBytes (out, &num_faces, 4);
+		out.push_back ((uint8_t)bits);
+		out.push_back (flags);
+		putBytes (out, lo.data, 12);
+		putBytes (out, extent.data, 12);
+
+		RangeEncoder rc (out);
+		IndexCoder coder;
+
+		std::vector<int> new_id (num_vertices, -1);
+		std::vector<int> order;
+		order.reserve (num_vertices);
+		std::vector<int> coded (stream.size());
+		const int slots = flags ? 6 : POLY_SIZE;
+		for (size_t i=0; i<stream.size(); ++i)
+		{
+			int v = stream[i];
+			if (new_id[v] < 0)
+			{
+				new_id[v] = order.size();
+				order.push_back (v);
+			}
+			coder.encode (rc, i % slots, new_id[v]);
+			coded[i] = new_id[v];
+		}
+		// Vertices no face refers to go last, in their original order.
+		for (uint32_t v=0; v<num_vertices; ++v)
+			if (new_id[v] < 0)
+			{
+				new_id[v] = order.size();
+				order.push_back (v);
+			}
+
+		std::vector<int> faces;
+		expandFaces (coded, flags, faces);
+
+		std::vector<int32_t> quantised (3*num_vertices);
+		// Rounded in double: in float, levels + 0.5 reaches 2^bits above 23 bits.
+		const double levels = (double)((1u << bits) - 1);
+		for (uint32_t k=0; k<num_vertices; ++k)
+			for (int c=0; c<3; ++c)
+			{
+				float t = extent[c] > 0 ? (vertices[order[k]][c] - lo[c]) / extent[c] : 0.f;
+				quantised[3*k+c] = (int32_t)std::floor (std::min (std::max (t, 0.f), 1.f) * levels + 0.5);
+			}
+
+		PositionPredictor predictor (num_vertices, faces);
+		IntegerModel residual[3];
+		for (uint32_t k=0; k<num_vertices; ++k)
+		{
+			int32_t prediction[3];
+			predictor.predict (k, quantised, prediction);
+			for (int c=0; c<3; ++c)
+				residual[c].encodeSigned (rc, quantised[3*k+c] - prediction[c]);
 		}
+		rc.flush();
 
 		return 0;
 	}
+
+	static int decode (
+			const uint8_t* data,
+			size_t size,
+			std::vector<Vector3f>& vertices,
+			std::vector<int>& indices
+	)
+	{
+		const size_t header = 4 + 4 + 4 + 2 + 24;
+		if (size < header || memcmp (data, "SUBZ", 4) != 0)
+			return -1;
+
+		uint32_t num_vertices, num_faces;
+		Vector3f lo, extent;
+		memcpy (&num_vertices, data+4, 4);
+		memcpy (&num_faces, data+8, 4);
+		int bits = data[12];
+		uint8_t flags = data[13];
+		memcpy (lo.data, data+14, 12);
+		memcpy (extent.data, data+26, 12);
+		if (bits < 1 || bits > 30 || (flags && num_faces % 4 != 0))
+			return -1;
+
+		const int slots = flags ? 6 : POLY_SIZE;
+		const size_t stream_size = flags ? (size_t)num_faces/4*6 : (size_t)num_faces*POLY_SIZE;
+
+		// The header counts are checked against the payload before anything
+		// is allocated. A coded bit costs at least log2(2048/2017) > 0.022
+		// bits, so each payload byte, plus the few bytes the decoder may read
+		// past the end, holds fewer than 400 bits. Every index takes at least
+		// one and every vertex at least 18: three 6-level length trees.
+		const uint64_t max_bits = 400 * ((uint64_t)(size - header) + 5);
+		if (stream_size + 18 * (uint64_t)num_vertices > max_bits)
+			return -1;
+
+		RangeDecoder rc (data + header, size - header);
+		IndexCoder coder;
+
+		std::vector<int> coded (stream_size);
+		for (size_t i=0; i<stream_size; ++i)
+		{
+			coded[i] = coder.decode (rc, i % slots);
+			if (coded[i] < 0 || (uint32_t)coded[i] >= num_vertices || rc.overrun())
+				return -1;
+		}
+
+		expandFaces (coded, flags, indices);
+
+		std::vector<int32_t> quantised (3*num_vertices);
+		PositionPredictor predictor (num_vertices, indices);
+		IntegerModel residual[3];
+		for (uint32_t k=0; k<num_vertices; ++k)
+		{
+			int32_t prediction[3];
+			predictor.predict (k, quantised, prediction);
+			for (int c=0; c<3; ++c)
+			{
+				// Corrupt residuals may leave the quantisation range, or int32_t.
+				int64_t value = (int64_t)prediction[c] + residual[c].decodeSigned (rc);
+				if (value < 0 || value >= ((int64_t)1 << bits))
+					return -1;
+				quantised[3*k+c] = (int32_t)value;
+			}
+		}
+		if (rc.overrun())
+			return -1;
+
+		const float levels = (float)((1u << bits) - 1);
+		vertices.resize (num_vertices);
+		for (uint32_t k=0; k<num_vertices; ++k)
+			for (int c=0; c<3; ++c)
+				vertices[k][c] = lo[c] + extent[c] * (quantised[3*k+c] / levels);
+
+		return 0;
+	}
+
+	private:
+		// Codes each index as "next new vertex" or as its distance below the
+		// newest vertex seen so far, with separate models for every slot.
+		struct IndexCoder
+		{
+			IndexCoder () : next_new(0)
+			{
+				for (int i=0; i<6; ++i) is_new[i] = initialBitModel();
+			}
+
+			void encode (RangeEncoder& rc, int slot, int id)
+			{
+				rc.encodeBit (is_new[slot], id == next_new);
+				if (id == next_new)
+					next_new++;
+				else
+					distance[slot].encode (rc, next_new - 1 - id);
+			}
+
+			int decode (RangeDecoder& rc, int slot)
+			{
+				if (rc.decodeBit (is_new[slot]))
+					return next_new++;
+				return next_new - 1 - (int)distance[slot].decode (rc);
+			}
+
+			int next_new;
+			BitModel is_new[6];
+			IntegerModel distance[6];
+		};
+
+		// Predicts a vertex as the average of its neighbours with smaller ids,
+		// or as the previous vertex when it has none.
+		struct PositionPredictor
+		{
+			PositionPredictor (size_t num_vertices, const std::vector<int>& faces)
+				: offsets (num_vertices+1, 0)
+			{
+				for (size_t i=0; i<faces.size(); ++i)
+					offsets[faces[i]+1] += 2;
+				for (size_t v=1; v<offsets.size(); ++v)
+					offsets[v] += offsets[v-1];
+				neighbours.resize (offsets.back());
+				std::vector<int> fill (offsets.begin(), offsets.end()-1);
+				for (size_t i=0; i<faces.size(); ++i)
+				{
+					size_t f = i - i % POLY_SIZE;
+					neighbours[fill[faces[i]]++] = faces[f + (i+1) % POLY_SIZE];
+					neighbours[fill[faces[i]]++] = faces[f + (i+2) % POLY_SIZE];
+				}
+			}
+
+			void predict (size_t v, const std::vector<int32_t>& q, int32_t* prediction) const
+			{
+				int64_t sum[3] = {0, 0, 0};
+				int64_t count = 0;
+				for (int k=offsets[v]; k<offsets[v+1]; ++k)
+				{
+					size_t u = neighbours[k];
+					if (u >= v) continue;
+					for (int c=0; c<3; ++c) sum[c] += q[3*u+c];
+					count++;
+				}
+				for (int c=0; c<3; ++c)
+				{
+					if (count > 0) prediction[c] = (int32_t)((sum[c] + count/2) / count);
+					else prediction[c] = (v > 0) ? q[3*(v-1)+c] : 0;
+				}
+			}
+
+			std::vector<int> offsets;
+			std::vector<int> neighbours;
+		};
+
+		static void putBytes (std::vector<uint8_t>& out, const void* p, size_t n)
+		{
+			const uint8_t* b = static_cast<const uint8_t*>(p);
+			out.insert (out.end(), b, b+n);
+		}
+
+		static void boundingBox (const std::vector<Vector3f>& vertices, Vector3f& lo, Vector3f& extent)
+		{
+			if (vertices.empty()) return;
+			Vector3f hi = vertices[0];
+			lo = vertices[0];
+			for (size_t i=1; i<vertices.size(); ++i)
+				for (int c=0; c<3; ++c)
+				{
+					lo[c] = std::min (lo[c], vertices[i][c]);
+					hi[c] = std::max (hi[c], vertices[i][c]);
+				}
+			extent = hi - lo;
+		}
+
+		static uint64_t edgeKey (int a, int b)
+		{
+			return ((uint64_t)(uint32_t)a << 32) | (uint32_t)b;
+		}
+
+		// Turns the coded index stream back into triangles.
+		static void expandFaces (const std::vector<int>& coded, uint8_t grouped, std::vector<int>& faces)
+		{
+			if (!grouped)
+			{
+				faces = coded;
+				return;
+			}
+
+			faces.clear();
+			faces.reserve (coded.size()*2);
+			for (size_t g=0; g+6<=coded.size(); g+=6)
+			{
+				const int* m = &coded[g];
+				const int* c = &coded[g+3];
+				const int tris[12] = {m[0], m[1], m[2], m[1], m[0], c[0], m[2], m[1], c[1], m[0], m[2], c[2]};
+				faces.insert (faces.end(), tris, tris+12);
+			}
+		}
+
+		// Breadth-first order over faces that share a vertex.
+		static void bfsOrder (size_t n, const std::vector<int>& offsets, const std::vector<int>& items,
+				const std::vector<int>& members, int per_item, std::vector<int>& order)
+		{
+			std::vector<char> seen (n, 0);
+			order.clear();
+			order.reserve (n);
+			for (size_t seed=0; seed<n; ++seed)
+			{
+				if (seen[seed]) continue;
+				seen[seed] = 1;
+				order.push_back (seed);
+				for (size_t q=order.size()-1; q<order.size(); ++q)
+					for (int k=0; k<per_item; ++k)
+					{
+						int v = members[per_item*order[q]+k];
+						for (int j=offsets[v]; j<offsets[v+1]; ++j)
+							if (!seen[items[j]])
+							{
+								seen[items[j]] = 1;
+								order.push_back (items[j]);
+							}
+					}
+			}
+		}
+
+		static void vertexItems (size_t num_vertices, const std::vector<int>& members, int per_item,
+				std::vector<int>& offsets, std::vector<int>& items)
+		{
+			offsets.assign (num_vertices+1, 0);
+			for (size_t i=0; i<members.size(); ++i)
+				offsets[members[i]+1]++;
+			for (size_t v=1; v<offsets.size(); ++v)
+				offsets[v] += offsets[v-1];
+			items.resize (members.size());
+			std::vector<int> fill (offsets.begin(), offsets.end()-1);
+			for (size_t i=0; i<members.size(); ++i)
+				items[fill[members[i]]++] = i / per_item;
+		}
+
+		static void faceOrder (size_t num_vertices, const std::vector<int>& indices, std::vector<int>& stream)
+		{
+			std::vector<int> offsets, items, order;
+			vertexItems (num_vertices, indices, POLY_SIZE, offsets, items);
+			bfsOrder (indices.size()/POLY_SIZE, offsets, items, indices, POLY_SIZE, order);
+
+			stream.clear();
+			stream.reserve (indices.size());
+			for (size_t i=0; i<order.size(); ++i)
+				for (int k=0; k<POLY_SIZE; ++k)
+					stream.push_back (indices[POLY_SIZE*order[i]+k]);
+		}
+
+		// Recognises the output of a 1-to-4 split of a closed mesh: the last
+		// 3F/8 vertices are edge midpoints, every parent triangle left a
+		// centre child made of three midpoints and three corner children.
+		// On success stream holds, per parent, the centre's midpoints and the
+		// corners across its three edges.
+		static bool groupedOrder (size_t num_vertices, const std::vector<int>& indices, std::vector<int>& stream)
+		{
+			const size_t num_faces = indices.size() / POLY_SIZE;
+			if (POLY_SIZE != 3 || num_faces == 0 || num_faces % 8 != 0 || num_vertices <= 3*num_faces/8)
+				return false;
+			const int first_mid = num_vertices - 3*num_faces/8;
+
+			std::unordered_map<uint64_t,int> edge_face;
+			edge_face.reserve (indices.size());
+			std::vector<int> centres;
+			for (size_t f=0; f<num_faces; ++f)
+			{
+				int mids = 0;
+				for (int k=0; k<3; ++k)
+				{
+					edge_face[edgeKey (indices[3*f+k], indices[3*f+(k+1)%3])] = f;
+					mids += indices[3*f+k] >= first_mid;
+				}
+				if (mids == 3) centres.push_back (f);
+			}
+			if (centres.size() != num_faces/4)
+				return false;
+
+			std::vector<int> groups;
+			groups.reserve (6*centres.size());
+			std::vector<char> used (num_faces, 0);
+			for (size_t g=0; g<centres.size(); ++g)
+			{
+				const int* m = &indices[3*centres[g]];
+				groups.insert (groups.end(), m, m+3);
+				for (int k=0; k<3; ++k)
+				{
+					auto found = edge_face.find (edgeKey (m[(k+1)%3], m[k]));
+					if (found == edge_face.end() || used[found->second]) return false;
+					int f = found->second;
+					used[f] = 1;
+
+					int corner = -1;
+					for (int j=0; j<3; ++j)
+						if (indices[3*f+j] != m[k] && indices[3*f+j] != m[(k+1)%3]) corner = indices[3*f+j];
+					if (corner < 0 || corner >= first_mid) return false;
+					groups.push_back (corner);
+				}
+			}
+
+			std::vector<int> offsets, items, order;
+			vertexItems (num_vertices, groups, 6, offsets, items);
+			bfsOrder (centres.size(), offsets, items, groups, 3, order);
+
+			stream.clear();
+			stream.reserve (groups.size());
+			for (size_t i=0; i<order.size(); ++i)
+				stream.insert (stream.end(), &groups[6*order[i]], &groups[6*order[i]]+6);
+
+			return true;
+		}
 };
 
 #endif
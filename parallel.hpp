@@ -0,0 +1,33 @@
+#ifndef PARALLEL_HPP_
+#define PARALLEL_HPP_
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+// Runs body(begin, end) over [0, n) split across the available cores.
+template <typename F>
+void parallelFor (size_t n, F body)
+{
+	size_t num_threads = std::max (1u, std::thread::hardware_concurrency());
+	num_threads = std::min (num_threads, std::max<size_t> (1, n / 4096));
+	if (num_threads == 1)
+	{
+		body (0, n);
+		return;
+	}
+
+	std::vector<std::thread> threads;
+	size_t chunk = (n + num_threads - 1) / num_threads;
+	for (size_t t=0; t<num_threads; ++t)
+	{
+		size_t begin = t*chunk;
+		size_t end = std::min (n, begin + chunk);
+		if (begin < end)
+			threads.push_back (std::thread (body, begin, end));
+	}
+	for (size_t t=0; t<threads.size(); ++t)
+		threads[t].join();
+}
+
+#endif
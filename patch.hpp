@@ -0,0 +1,453 @@
+#ifndef PATCH_HPP_
+#define PATCH_HPP_
+
+#include "linalgebra.hpp"
+#include "mesh.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Topology of a closed triangle control mesh, and the numbering of the
+// vertices of its regular 1-to-4 refinements.
+//
+// With N = 2^level, vertices are numbered by their position on the control
+// mesh: control vertices first, then the (N-1) interior vertices of every
+// control edge, then the interior vertices of every control face. A point
+// of control face f is given by integer barycentric weights (i, j, k) over
+// its corners, with i + j + k = N.
+struct ControlCage
+{
+	ControlCage (const std::vector<int>& indices, size_t num_vertices)
+		: indices(indices.begin(), indices.end()), num_vertices(num_vertices), closed(true)
+	{
+		num_faces = indices.size() / POLY_SIZE;
+
+		vf_offsets.assign (num_vertices + 1, 0);
+		for (size_t i=0; i<indices.size(); ++i)
+			vf_offsets[indices[i]+1]++;
+		for (size_t v=1; v<vf_offsets.size(); ++v)
+			vf_offsets[v] += vf_offsets[v-1];
+		vf_faces.resize (indices.size());
+		ScratchVector<int> fill (vf_offsets.begin(), vf_offsets.end()-1);
+		for (size_t i=0; i<indices.size(); ++i)
+			vf_faces[fill[indices[i]]++] = i / POLY_SIZE;
+
+		ScratchVector<int> uses, twin_corners, corner_edges (indices.size());
+		for (size_t i=0; i<indices.size(); ++i)
+		{
+			int a = indices[i];
+			int b = indices[(i % POLY_SIZE == POLY_SIZE-1) ? i+1-POLY_SIZE : i+1];
+			auto inserted = edge_ids.insert (std::make_pair (edgeKey (std::min(a,b), std::max(a,b)), (int)edge_ids.size()));
+			if (inserted.second)
+			{
+				edge_corners.push_back (i);
+				uses.push_back (0);
+				twin_corners.push_back (-1);
+			}
+			// The second use of an edge must run the other way.
+			int e = inserted.first->second;
+			corner_edges[i] = e;
+			if (a == b || ++uses[e] > 2 || (uses[e] == 2 && indices[edge_corners[e]] != b))
+				closed = false;
+			if (uses[e] == 2)
+				twin_corners[e] = i;
+		}
+		for (size_t e=0; e<uses.size(); ++e)
+			if (uses[e] != 2) closed = false;
+		if (!closed)
+			return;
+
+		// Every vertex needs faces, and they must form a single fan: the
+		// walk from one of them through shared edges has to reach them all.
+		for (size_t v=0; v<num_vertices; ++v)
+		{
+			int valence = vf_offsets[v+1] - vf_offsets[v];
+			if (valence == 0)
+			{
+				closed = false;
+				return;
+			}
+			int f = vf_faces[vf_offsets[v]];
+			int start = POLY_SIZE*f;
+			while (indices[start] != (int)v) start++;
+			int corner = start, steps = 0;
+			do{
+				// The edge into v in this face, taken from the other side.
+				int before = (corner % POLY_SIZE == 0) ? corner+POLY_SIZE-1 : corner-1;
+				int e = corner_edges[before];
+				corner = (edge_corners[e] == before) ? twin_corners[e] : edge_corners[e];
+				steps++;
+			} while (corner != start && steps <= valence);
+			if (steps != valence)
+			{
+				closed = false;
+				return;
+			}
+		}
+	}
+
+	static uint64_t edgeKey (int a, int b)
+	{
+		return ((uint64_t)(uint32_t)a << 32) | (uint32_t)b;
+	}
+
+	size_t numEdges () const { return edge_ids.size(); }
+
+	size_t numVertices (int N) const
+	{
+		return num_vertices + edge_ids.size()*(N-1) + num_faces*(N-1)*(N-2)/2;
+	}
+
+	int64_t edgeVertexId (int a, int b, int t, int N) const
+	{
+		int e = edge_ids.find (edgeKey (std::min(a,b), std::max(a,b)))->second;
+		int from_min = (a < b) ? t : N - t;
+		return num_vertices + (int64_t)e*(N-1) + from_min - 1;
+	}
+
+	// Global id of the point i*A + j*B + k*C (over N) of control face f.
+	int64_t globalId (int f, int i, int j, int N) const
+	{
+		int k = N - i - j;
+		int A = indices[POLY_SIZE*f], B = indices[POLY_SIZE*f+1], C = indices[POLY_SIZE*f+2];
+
+		if (i == N) return A;
+		if (j == N) return B;
+		if (k == N) return C;
+		if (k == 0) return edgeVertexId (A, B, j, N);
+		if (i == 0) return edgeVertexId (B, C, k, N);
+		if (j == 0) return edgeVertexId (C, A, i, N);
+
+		int64_t interior = (int64_t)(i-1)*(N-1) - (int64_t)(i-1)*i/2 + (j-1);
+		return num_vertices + (int64_t)edge_ids.size()*(N-1) + (int64_t)f*(N-1)*(N-2)/2 + interior;
+	}
+
+	ScratchVector<int> indices;
+	size_t num_vertices;
+	size_t num_faces;
+	// Every edge is shared by exactly two consistently oriented faces and
+	// the faces around every vertex form one fan.
+	bool closed;
+
+	ScratchVector<int> vf_offsets;
+	ScratchVector<int> vf_faces;
+	ScratchMap<uint64_t,int> edge_ids;
+	// For every edge id, the index in 'indices' of its first half-edge.
+	ScratchVector<int> edge_corners;
+};
+
+// A vertex of the refined mesh, as weights over the corners of one control
+// face that contains it.
+struct PatchPoint
+{
+	int face;
+	int w[3];
+};
+
+// Loop/butterfly refinement of a closed triangle mesh stored as one
+// regular triangular grid per control face.
+//
+// Only the control cage keeps explicit adjacency. Positions of the current
+// level are a flat array in ControlCage order; the neighbours of a vertex
+// follow from its grid coordinates, and only vertices on control edges or
+// at control vertices look at the cage to step into a neighbouring face.
+// No per-vertex, per-edge or per-face records exist below the cage.
+class PatchMesh
+{
+	public:
+		PatchMesh (
+				const std::vector<Vector3f>& positions,
+				const std::vector<int>& indices,
+				SubdivisionScheme scheme
+		) : cage(indices, positions.size()), scheme(scheme), N(1), positions(positions.begin(), positions.end())
+		{
+		}
+
+		int level () const
+		{
+			int l = 0;
+			while ((1 << l) < N) l++;
+			return l;
+		}
+
+		size_t numVertices () const { return positions.size(); }
+		size_t numFaces () const { return cage.num_faces * N * N; }
+
+		// Bytes held for the current level: positions plus the cage.
+		size_t memoryBytes () const
+		{
+			return positions.capacity()*sizeof(Vector3f)
+				+ (cage.indices.capacity() + cage.vf_offsets.capacity() + cage.vf_faces.capacity()
+					+ cage.edge_corners.capacity())*sizeof(int)
+				+ cage.edge_ids.size()*(sizeof(uint64_t) + sizeof(int) + 2*sizeof(void*));
+		}
+
+		// One level of 1-to-4 refinement. Returns -1 for schemes that do not
+		// split triangles 1-to-4 and for control meshes that are not closed.
+		int subdivide ()
+		{
+			if ((scheme != LOOP && scheme != BUTTERFLY) || !cage.closed)
+				return -1;
+
+			const int fine = 2*N;
+			ScratchVector<Vector3f> refined (cage.numVertices (fine));
+
+			parallelFor (cage.num_vertices, [&](size_t begin, size_t end)
+			{
+				for (size_t v=begin; v<end; ++v)
+				{
+					int corner = cornerOf (cage.vf_faces[cage.vf_offsets[v]], v);
+					PatchPoint p = {corner / POLY_SIZE, {0, 0, 0}};
+					p.w[corner % POLY_SIZE] = fine;
+					refined[v] = evaluate (p);
+				}
+			});
+
+			parallelFor (cage.numEdges(), [&](size_t begin, size_t end)
+			{
+				for (size_t e=begin; e<end; ++e)
+				{
+					int corner = cage.edge_corners[e];
+					int c = corner % POLY_SIZE;
+					for (int t=1; t<fine; ++t)
+					{
+						PatchPoint p = {corner / POLY_SIZE, {0, 0, 0}};
+						p.w[c] = fine - t;
+						p.w[(c+1) % POLY_SIZE] = t;
+						refined[id (p, fine)] = evaluate (p);
+					}
+				}
+			});
+
+			parallelFor (cage.num_faces, [&](size_t begin, size_t end)
+			{
+				for (size_t f=begin; f<end; ++f)
+					for (int i=1; i<fine; ++i)
+						for (int j=1; i+j<fine; ++j)
+						{
+							PatchPoint p = {(int)f, {i, j, fine-i-j}};
+							refined[id (p, fine)] = evaluate (p);
+						}
+			});
+
+			positions.swap (refined);
+			N = fine;
+
+			return 0;
+		}
+
+		// Packed xyz positions and triangle indices of the current level.
+		void exportMesh (std::vector<float>& out_positions, std::vector<int>& out_indices) const
+		{
+			out_positions.resize (3*positions.size());
+			for (size_t v=0; v<positions.size(); ++v)
+				for (int c=0; c<3; ++c)
+					out_positions[3*v+c] = positions[v][c];
+
+			out_indices.clear();
+			out_indices.reserve (numFaces()*POLY_SIZE);
+			for (size_t f=0; f<cage.num_faces; ++f)
+				for (int i=0; i<N; ++i)
+					for (int j=0; i+j<N; ++j)
+					{
+						// Triangle pointing like the control face, then the
+						// one pointing the other way, which shares its edge
+						// opposite (i, j).
+						out_indices.push_back (cage.globalId (f, i+1, j, N));
+						out_indices.push_back (cage.globalId (f, i, j+1, N));
+						out_indices.push_back (cage.globalId (f, i, j, N));
+						if (i+j+2 > N) continue;
+						out_indices.push_back (cage.globalId (f, i, j+1, N));
+						out_indices.push_back (cage.globalId (f, i+1, j, N));
+						out_indices.push_back (cage.globalId (f, i+1, j+1, N));
+					}
+		}
+
+	private:
+		int cornerOf (int f, int v) const
+		{
+			for (int c=0; c<POLY_SIZE; ++c)
+				if (cage.indices[POLY_SIZE*f+c] == v) return POLY_SIZE*f + c;
+			return -1;
+		}
+
+		int64_t id (const PatchPoint& p, int n) const
+		{
+			return cage.globalId (p.face, p.w[0], p.w[1], n);
+		}
+
+		const Vector3f& at (const PatchPoint& p) const
+		{
+			return positions[id (p, N)];
+		}
+
+		// The same point expressed over the corners of face g, if g holds it.
+		bool toFace (const PatchPoint& p, int g, PatchPoint& result) const
+		{
+			result.face = g;
+			int total = 0;
+			for (int c=0; c<POLY_SIZE; ++c)
+			{
+				result.w[c] = 0;
+				for (int k=0; k<POLY_SIZE; ++k)
+					if (cage.indices[POLY_SIZE*g+c] == cage.indices[POLY_SIZE*p.face+k])
+						result.w[c] += p.w[k];
+				total += result.w[c];
+			}
+			return total == N;
+		}
+
+		// A control vertex carrying weight in p: every control face holding
+		// p is incident to it.
+		int supportVertex (const PatchPoint& p) const
+		{
+			int c = 0;
+			for (int k=1; k<POLY_SIZE; ++k)
+				if (p.w[k] > p.w[c]) c = k;
+			return cage.indices[POLY_SIZE*p.face+c];
+		}
+
+		// Third vertex of the triangle left of the edge p->q. Inside a face
+		// this is q-p turned by 60 degrees, added to p; on a control edge
+		// the triangle may belong to the face across. On a closed cage,
+		// which subdivide() requires, that face always exists.
+		PatchPoint opposite (const PatchPoint& p, const PatchPoint& q) const
+		{
+			PatchPoint a = p, b, r;
+			if (toFace (q, p.face, b) && turnLeft (a, b, r))
+				return r;
+
+			int v = supportVertex (p);
+			for (int k=cage.vf_offsets[v]; k<cage.vf_offsets[v+1]; ++k)
+			{
+				int g = cage.vf_faces[k];
+				if (g != p.face && toFace (p, g, a) && toFace (q, g, b) && turnLeft (a, b, r))
+					return r;
+			}
+			return p; // Unreachable on a closed cage.
+		}
+
+		static bool turnLeft (const PatchPoint& p, const PatchPoint& q, PatchPoint& r)
+		{
+			r.face = p.face;
+			for (int c=0; c<POLY_SIZE; ++c)
+			{
+				r.w[c] = p.w[c] - (q.w[(c+1) % POLY_SIZE] - p.w[(c+1) % POLY_SIZE]);
+				if (r.w[c] < 0) return false;
+			}
+			return true;
+		}
+
+		// Sum and count of the one-ring of p.
+		int ringSum (const PatchPoint& p, Vector3f& sum) const
+		{
+			static const int directions[6][3] = {
+				{1, -1, 0}, {1, 0, -1}, {0, 1, -1}, {-1, 1, 0}, {-1, 0, 1}, {0, -1, 1}
+			};
+
+			if (p.w[0] > 0 && p.w[1] > 0 && p.w[2] > 0)
+			{
+				for (int d=0; d<6; ++d)
+				{
+					PatchPoint n = {p.face, {p.w[0]+directions[d][0], p.w[1]+directions[d][1], p.w[2]+directions[d][2]}};
+					sum += at (n);
+				}
+				return 6;
+			}
+
+			// On the cage: gather from every incident face, dropping the
+			// neighbours two faces share. Rings above 64 spill to the heap.
+			int64_t seen[64];
+			ScratchVector<int64_t> more;
+			int count = 0;
+			int v = supportVertex (p);
+			for (int k=cage.vf_offsets[v]; k<cage.vf_offsets[v+1]; ++k)
+			{
+				PatchPoint a;
+				if (!toFace (p, cage.vf_faces[k], a)) continue;
+				for (int d=0; d<6; ++d)
+				{
+					PatchPoint n = {a.face, {a.w[0]+directions[d][0], a.w[1]+directions[d][1], a.w[2]+directions[d][2]}};
+					if (n.w[0] < 0 || n.w[1] < 0 || n.w[2] < 0) continue;
+					int64_t gid = id (n, N);
+					int64_t* seen_end = seen + std::min (count, 64);
+					if (std::find (seen, seen_end, gid) != seen_end || std::find (more.begin(), more.end(), gid) != more.end())
+						continue;
+					if (count < 64)
+						seen[count] = gid;
+					else
+						more.push_back (gid);
+					count++;
+					sum += positions[gid];
+				}
+			}
+			return count;
+		}
+
+		// Position of the point p of the next level.
+		Vector3f evaluate (const PatchPoint& p) const
+		{
+			int odd = 0;
+			for (int c=0; c<POLY_SIZE; ++c)
+				odd += p.w[c] & 1;
+
+			if (odd == 0)
+			{
+				PatchPoint v = {p.face, {p.w[0]/2, p.w[1]/2, p.w[2]/2}};
+				if (scheme == BUTTERFLY)
+					return at (v);
+
+				Vector3f sum;
+				int n = ringSum (v, sum);
+				float alpha_n = loopAlpha (n);
+				Vector3f result = alpha_n*at (v);
+				return result.addScaled ((1-alpha_n)/n, sum);
+			}
+
+			// Two odd weights: the midpoint of an edge of this level.
+			PatchPoint a = {p.face, {0, 0, 0}}, b = {p.face, {0, 0, 0}};
+			bool first = true;
+			for (int c=0; c<POLY_SIZE; ++c)
+			{
+				if (p.w[c] & 1)
+				{
+					a.w[c] = (p.w[c] + (first ? 1 : -1)) / 2;
+					b.w[c] = (p.w[c] + (first ? -1 : 1)) / 2;
+					first = false;
+				}
+				else
+					a.w[c] = b.w[c] = p.w[c] / 2;
+			}
+
+			PatchPoint c = opposite (a, b);
+			PatchPoint d = opposite (b, a);
+
+			Vector3f result;
+			if (scheme == LOOP)
+			{
+				return result.addScaled (3.f/8.f, at (a))
+					.addScaled (3.f/8.f, at (b))
+					.addScaled (1.f/8.f, at (c))
+					.addScaled (1.f/8.f, at (d));
+			}
+
+			return result.addScaled (1.f/2.f, at (a))
+				.addScaled (1.f/2.f, at (b))
+				.addScaled (1.f/8.f, at (c))
+				.addScaled (1.f/8.f, at (d))
+				.addScaled (-1.f/16.f, at (opposite (c, b)))
+				.addScaled (-1.f/16.f, at (opposite (a, c)))
+				.addScaled (-1.f/16.f, at (opposite (d, a)))
+				.addScaled (-1.f/16.f, at (opposite (b, d)));
+		}
+
+		ControlCage cage;
+		SubdivisionScheme scheme;
+		int N;
+		ScratchVector<Vector3f> positions;
+};
+
+#endif
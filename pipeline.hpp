@@ -0,0 +1,282 @@
+#ifndef PIPELINE_HPP_
+#define PIPELINE_HPP_
+
+#include "mesh.hpp"
+#include "meshio.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Fixed-capacity blocking queue used between pipeline stages. push()
+// blocks while the queue is full, which is what bounds the number of
+// meshes (or output chunks) alive at any time.
+template <typename T>
+class BoundedQueue
+{
+	public:
+		BoundedQueue (size_t capacity) : capacity(capacity), closed(false) {}
+
+		bool push (T item)
+		{
+			std::unique_lock<std::mutex> lock (mutex);
+			not_full.wait (lock, [this]{ return closed || items.size() < capacity; });
+			if (closed) return false;
+			items.push_back (std::move(item));
+			not_empty.notify_one();
+			return true;
+		}
+
+		// Returns false once the queue is closed and drained.
+		bool pop (T& item)
+		{
+			std::unique_lock<std::mutex> lock (mutex);
+			not_empty.wait (lock, [this]{ return closed || !items.empty(); });
+			if (items.empty()) return false;
+			item = std::move (items.front());
+			items.pop_front();
+			not_full.notify_one();
+			return true;
+		}
+
+		void close ()
+		{
+			std::lock_guard<std::mutex> lock (mutex);
+			closed = true;
+			not_empty.notify_all();
+			not_full.notify_all();
+		}
+
+	private:
+		size_t capacity;
+		bool closed;
+		std::deque<T> items;
+		std::mutex mutex;
+		std::condition_variable not_empty;
+		std::condition_variable not_full;
+};
+
+// Stream buffer that hands fixed-size chunks of formatted output to a
+// queue, so formatting and the actual disk writes run on different threads.
+class ChunkStreamBuf : public std::streambuf
+{
+	public:
+		ChunkStreamBuf (BoundedQueue<std::string>& queue, size_t chunk_size)
+			: queue(queue), chunk_size(chunk_size)
+		{
+			chunk.reserve (chunk_size);
+		}
+
+		~ChunkStreamBuf () { flushChunk(); }
+
+		void flushChunk ()
+		{
+			if (chunk.empty()) return;
+			queue.push (std::move(chunk));
+			chunk = std::string();
+			chunk.reserve (chunk_size);
+		}
+
+	protected:
+		int_type overflow (int_type c)
+		{
+			if (c == traits_type::eof()) return traits_type::not_eof(c);
+			chunk.push_back (traits_type::to_char_type(c));
+			if (chunk.size() >= chunk_size) flushChunk();
+			return c;
+		}
+
+		std::streamsize xsputn (const char* s, std::streamsize n)
+		{
+			chunk.append (s, n);
+			if (chunk.size() >= chunk_size) flushChunk();
+			return n;
+		}
+
+	private:
+		BoundedQueue<std::string>& queue;
+		std::string chunk;
+		size_t chunk_size;
+};
+
+// An output file fed through a ChunkStreamBuf, with a sink thread that
+// writes the chunks to disk as they are produced.
+struct ChunkedOutput
+{
+	ChunkedOutput (const std::string& path, size_t chunk_size, size_t max_chunks)
+		: fs(path, std::ofstream::out | std::ofstream::binary), chunks(max_chunks), buf(chunks, chunk_size), os(&buf)
+	{
+		if (!fs) return;
+		sink = std::thread ([this]() {
+			std::string chunk;
+			while (chunks.pop (chunk))
+				if (fs) fs.write (chunk.data(), chunk.size());
+			fs.close();
+		});
+	}
+
+	~ChunkedOutput () { finish(); }
+
+	bool opened () const { return sink.joinable(); }
+
+	// Hands over the last chunk and waits for the sink. Returns false if
+	// anything failed to reach the disk.
+	bool finish ()
+	{
+		if (!sink.joinable()) return false;
+		buf.flushChunk();
+		chunks.close();
+		sink.join();
+		return !fs.fail();
+	}
+
+	std::ofstream fs;
+	BoundedQueue<std::string> chunks;
+	ChunkStreamBuf buf;
+	std::ostream os;
+	std::thread sink;
+};
+
+struct PipelineJob
+{
+	PipelineJob () : index(0), status(0) {}
+
+	std::string input;
+	std::string output;
+	std::unique_ptr<StandardMesh> mesh;
+	// Opened by the refiner once the vertex block of the last level is
+	// final and written there; the writer then only adds the faces.
+	std::unique_ptr<ChunkedOutput> out;
+
+	size_t index;
+	// 0 once the output is on disk, -1 if loading or writing failed.
+	int status;
+};
+
+// Runs load -> subdivide -> write as three concurrent stages connected by
+// bounded queues: while job N is refined, job N+1 is parsed and job N-1
+// is written. OBJ text is produced in chunks that a sink thread writes to
+// disk, so formatting overlaps with I/O.
+//
+// For Loop and butterfly every "v" record is final as soon as the last
+// level has computed its vertex and edge points, before it rebuilds any
+// topology. The refiner opens the output at that point and streams the
+// vertex block, so it reaches the disk while the level is still splitting
+// faces; the writer stage appends the "f" records. For sqrt3, and with no
+// levels at all, the writer stage writes the whole file.
+//
+// At most 2*queue_depth + 3 meshes are alive at once.
+inline int runPipeline (
+		std::vector<PipelineJob>& jobs,
+		SubdivisionScheme scheme,
+		int iterations,
+		size_t queue_depth = 1,
+		size_t chunk_size = 1 << 20,
+		size_t max_chunks = 8
+)
+{
+	BoundedQueue<PipelineJob> to_refine (queue_depth);
+	BoundedQueue<PipelineJob> to_write (queue_depth);
+	int status = 0;
+	std::mutex status_mutex;
+	auto fail = [&](size_t index) {
+		std::lock_guard<std::mutex> lock (status_mutex);
+		status = -1;
+		jobs[index].status = -1;
+	};
+	for (size_t i=0; i<jobs.size(); ++i)
+		jobs[i].status = 0;
+
+	std::thread parser ([&]() {
+		for (size_t i=0; i<jobs.size(); ++i)
+		{
+			PipelineJob job;
+			job.input = jobs[i].input;
+			job.output = jobs[i].output;
+			job.index = i;
+			job.mesh.reset (new StandardMesh());
+			if (MeshIO<MeshFileType::OBJ>::loadMesh (job.input, *job.mesh) < 0)
+			{
+				fail (i);
+				continue;
+			}
+			if (!to_refine.push (std::move(job))) break;
+		}
+		to_refine.close();
+	});
+
+	std::thread refiner ([&]() {
+		PipelineJob job;
+		while (to_refine.pop (job))
+		{
+			bool refined = true;
+			for (int i=0; i<iterations && refined; ++i)
+			{
+				if (i == iterations-1)
+					job.mesh->positions_ready = [&](const ScratchVector<Vector3f>& vertex_points, const ScratchVector<Vector3f>& edge_points)
+					{
+						job.out.reset (new ChunkedOutput (job.output, chunk_size, max_chunks));
+						if (!job.out->opened()) return;
+						for (size_t v=0; v<vertex_points.size(); ++v)
+							job.out->os << "v " << vertex_points[v] << '\n';
+						for (size_t v=0; v<edge_points.size(); ++v)
+							job.out->os << "v " << edge_points[v] << '\n';
+					};
+				refined = job.mesh->subdivide (scheme) == 0;
+			}
+			job.mesh->positions_ready = nullptr;
+			if (!refined)
+			{
+				job.out.reset();
+				fail (job.index);
+				continue;
+			}
+			if (!to_write.push (std::move(job))) break;
+		}
+		to_write.close();
+	});
+
+	std::thread writer ([&]() {
+		PipelineJob job;
+		while (to_write.pop (job))
+		{
+			bool streamed = job.out != nullptr;
+			if (!streamed)
+				job.out.reset (new ChunkedOutput (job.output, chunk_size, max_chunks));
+			if (!job.out->opened())
+			{
+				std::cout << "Output file \"" << job.output << "\" could not be opened." << std::endl;
+				fail (job.index);
+				job.out.reset();
+				job.mesh.reset();
+				continue;
+			}
+
+			if (streamed)
+				MeshIO<MeshFileType::OBJ>::writeFaces (job.out->os, *job.mesh);
+			else
+				MeshIO<MeshFileType::OBJ>::writeMesh (job.out->os, *job.mesh);
+			if (!job.out->finish())
+			{
+				std::cout << "Output file \"" << job.output << "\" could not be written." << std::endl;
+				fail (job.index);
+			}
+			job.out.reset();
+			job.mesh.reset();
+		}
+	});
+
+	parser.join();
+	refiner.join();
+	writer.join();
+
+	return status;
+}
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef PROFILE_HPP_
+#define PROFILE_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+// Process-wide counters fed by CountingAllocator. Counting is off until
+// enable() is called, so allocations cost one relaxed load otherwise.
+// Enable it before the containers to be measured are created; blocks
+// allocated earlier are not subtracted when they are released.
+struct AllocationCounters
+{
+	std::atomic<bool> enabled;
+	std::atomic<size_t> count;
+	std::atomic<size_t> bytes;
+	std::atomic<size_t> live;
+	std::atomic<size_t> peak;
+
+	AllocationCounters () : enabled(false), count(0), bytes(0), live(0), peak(0) {}
+
+	void enable () { enabled.store (true, std::memory_order_relaxed); }
+
+	void allocated (size_t n)
+	{
+		if (!enabled.load (std::memory_order_relaxed)) return;
+		count.fetch_add (1, std::memory_order_relaxed);
+		bytes.fetch_add (n, std::memory_order_relaxed);
+		size_t now = live.fetch_add (n, std::memory_order_relaxed) + n;
+		size_t old_peak = peak.load (std::memory_order_relaxed);
+		while (now > old_peak && !peak.compare_exchange_weak (old_peak, now, std::memory_order_relaxed)) {}
+	}
+
+	void released (size_t n)
+	{
+		if (!enabled.load (std::memory_order_relaxed)) return;
+		live.fetch_sub (n, std::memory_order_relaxed);
+	}
+};
+
+inline AllocationCounters& allocationCounters ()
+{
+	static AllocationCounters counters;
+	return counters;
+}
+
+// Allocator for the Mesh containers and scratch vectors; identical to
+// std::allocator apart from keeping allocationCounters() up to date.
+template <typename T>
+struct CountingAllocator
+{
+	typedef T value_type;
+
+	CountingAllocator () {}
+	template <typename U> CountingAllocator (const CountingAllocator<U>&) {}
+
+	T* allocate (size_t n)
+	{
+		allocationCounters().allocated (n*sizeof(T));
+		return static_cast<T*> (::operator new (n*sizeof(T)));
+	}
+
+	void deallocate (T* p, size_t n)
+	{
+		allocationCounters().released (n*sizeof(T));
+		::operator delete (p);
+	}
+};
+
+template <typename T, typename U>
+bool operator== (const CountingAllocator<T>&, const CountingAllocator<U>&) { return true; }
+
+template <typename T, typename U>
+bool operator!= (const CountingAllocator<T>&, const CountingAllocator<U>&) { return false; }
+
+// Peak resident set size of the whole process since it started, in bytes;
+// 0 where unsupported. It never decreases, so a phase only shows a new
+// value when it raised the high-water mark.
+inline size_t peakRSS ()
+{
+#if defined(__unix__) || defined(__APPLE__)
+	struct rusage usage;
+	if (getrusage (RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__)
+	return usage.ru_maxrss;
+#else
+	return (size_t)usage.ru_maxrss * 1024;
+#endif
+#else
+	return 0;
+#endif
+}
+
+// Collects per-phase allocation figures. Phases are sequential: begin()
+// closes the running phase, if any, and starts a new one.
+class AllocationProfile
+{
+	public:
+		AllocationProfile () : running(false) {}
+
+		void begin (std::string name)
+		{
+			end();
+			AllocationCounters& c = allocationCounters();
+			current.name = name;
+			current.count = c.count.load();
+			current.bytes = c.bytes.load();
+			current.start = std::chrono::steady_clock::now();
+			c.peak.store (c.live.load());
+			running = true;
+		}
+
+		void end ()
+		{
+			if (!running) return;
+			AllocationCounters& c = allocationCounters();
+			current.count = c.count.load() - current.count;
+			current.bytes = c.bytes.load() - current.bytes;
+			current.peak_live = c.peak.load();
+			current.peak_rss = peakRSS();
+			current.seconds = std::chrono::duration<double> (std::chrono::steady_clock::now() - current.start).count();
+			phases.push_back (current);
+			running = false;
+		}
+
+		void report (std::ostream& os)
+		{
+			end();
+			os << std::left << std::setw(20) << "phase"
+				<< std::right << std::setw(14) << "allocations"
+				<< std::setw(16) << "bytes"
+				<< std::setw(16) << "peak live"
+				<< std::setw(26) << "process peak RSS so far"
+				<< std::setw(12) << "seconds" << '\n';
+			for (size_t i=0; i<phases.size(); ++i)
+			{
+				os << std::left << std::setw(20) << phases[i].name
+					<< std::right << std::setw(14) << phases[i].count
+					<< std::setw(16) << phases[i].bytes
+					<< std::setw(16) << phases[i].peak_live
+					<< std::setw(26) << phases[i].peak_rss
+					<< std::setw(12) << std::fixed << std::setprecision(3) << phases[i].seconds << '\n';
+			}
+			os.flush();
+		}
+
+	private:
+		struct Phase
+		{
+			std::string name;
+			size_t count;
+			size_t bytes;
+			size_t peak_live;
+			size_t peak_rss;
+			double seconds;
+			std::chrono::steady_clock::time_point start;
+		};
+
+		bool running;
+		Phase current;
+		std::vector<Phase> phases;
+};
+
+#endif
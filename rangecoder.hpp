@@ -0,0 +1,186 @@
+#ifndef RANGECODER_HPP_
+#define RANGECODER_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Adaptive binary range coder (the LZMA construction): each bit is coded
+// with an 11-bit probability that adapts towards the bits seen so far.
+
+const int RC_PROB_BITS = 11;
+const int RC_MOVE_BITS = 5;
+const uint32_t RC_TOP = 1u << 24;
+
+typedef uint16_t BitModel;
+
+inline BitModel initialBitModel () { return 1 << (RC_PROB_BITS-1); }
+
+class RangeEncoder
+{
+	public:
+		RangeEncoder (std::vector<uint8_t>& out)
+			: out(out), low(0), range(0xFFFFFFFF), cache(0), cache_size(1) {}
+
+		void encodeBit (BitModel& prob, int bit)
+		{
+			uint32_t bound = (range >> RC_PROB_BITS) * prob;
+			if (bit == 0)
+			{
+				range = bound;
+				prob += ((1 << RC_PROB_BITS) - prob) >> RC_MOVE_BITS;
+			}
+			else
+			{
+				low += bound;
+				range -= bound;
+				prob -= prob >> RC_MOVE_BITS;
+			}
+			while (range < RC_TOP)
+			{
+				range <<= 8;
+				shiftLow();
+			}
+		}
+
+		void flush ()
+		{
+			for (int i=0; i<5; ++i)
+				shiftLow();
+		}
+
+	private:
+		void shiftLow ()
+		{
+			if ((uint32_t)low < 0xFF000000u || (low >> 32) != 0)
+			{
+				uint8_t carry = (uint8_t)(low >> 32);
+				uint8_t temp = cache;
+				do {
+					out.push_back ((uint8_t)(temp + carry));
+					temp = 0xFF;
+				} while (--cache_size != 0);
+				cache = (uint8_t)(low >> 24);
+			}
+			cache_size++;
+			low = (low & 0x00FFFFFF) << 8;
+		}
+
+		std::vector<uint8_t>& out;
+		uint64_t low;
+		uint32_t range;
+		uint8_t cache;
+		uint64_t cache_size;
+};
+
+class RangeDecoder
+{
+	public:
+		RangeDecoder (const uint8_t* data, size_t size)
+			: data(data), size(size), pos(0), range(0xFFFFFFFF), code(0)
+		{
+			for (int i=0; i<5; ++i)
+				code = (code << 8) | nextByte();
+		}
+
+		int decodeBit (BitModel& prob)
+		{
+			uint32_t bound = (range >> RC_PROB_BITS) * prob;
+			int bit;
+			if (code < bound)
+			{
+				range = bound;
+				prob += ((1 << RC_PROB_BITS) - prob) >> RC_MOVE_BITS;
+				bit = 0;
+			}
+			else
+			{
+				code -= bound;
+				range -= bound;
+				prob -= prob >> RC_MOVE_BITS;
+				bit = 1;
+			}
+			while (range < RC_TOP)
+			{
+				range <<= 8;
+				code = (code << 8) | nextByte();
+			}
+			return bit;
+		}
+
+		// True once the decoder has read past the end of its input.
+		bool overrun () const { return pos > size + 4; }
+
+	private:
+		uint8_t nextByte ()
+		{
+			return (pos < size) ? data[pos++] : (pos++, 0);
+		}
+
+		const uint8_t* data;
+		size_t size;
+		size_t pos;
+		uint32_t range;
+		uint32_t code;
+};
+
+// Adaptive Exp-Golomb code for unsigned integers: the bit length of v+1 is
+// coded with a 6-level bit tree, then the bits below the leading one with
+// models indexed by (length, position).
+class IntegerModel
+{
+	public:
+		IntegerModel ()
+		{
+			for (int i=0; i<64; ++i) length_tree[i] = initialBitModel();
+			for (int i=0; i<33*32; ++i) mantissa[i] = initialBitModel();
+		}
+
+		void encode (RangeEncoder& rc, uint32_t value)
+		{
+			uint64_t n = (uint64_t)value + 1;
+			int k = 0;
+			while ((n >> (k+1)) != 0) k++;
+
+			int node = 1;
+			for (int i=5; i>=0; --i)
+			{
+				int bit = (k >> i) & 1;
+				rc.encodeBit (length_tree[node], bit);
+				node = 2*node + bit;
+			}
+			for (int i=k-1; i>=0; --i)
+				rc.encodeBit (mantissa[32*k + i], (n >> i) & 1);
+		}
+
+		uint32_t decode (RangeDecoder& rc)
+		{
+			int node = 1;
+			for (int i=0; i<6; ++i)
+				node = 2*node + rc.decodeBit (length_tree[node]);
+			int k = node - 64;
+			if (k > 32) k = 32;
+
+			uint64_t n = 1;
+			for (int i=k-1; i>=0; --i)
+				n = (n << 1) | rc.decodeBit (mantissa[32*k + i]);
+			return (uint32_t)(n - 1);
+		}
+
+		void encodeSigned (RangeEncoder& rc, int32_t value)
+		{
+			encode (rc, ((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+		}
+
+		int32_t decodeSigned (RangeDecoder& rc)
+		{
+			uint32_t z = decode (rc);
+			return (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+		}
+
+	private:
+		BitModel length_tree[64];
+		BitModel mantissa[33*32];
+};
+
+#endif
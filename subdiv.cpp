@@ -0,0 +1,240 @@
+#include "subdiv.h"
+#include "mesh.hpp"
+
+#include <algorithm>
+#include <new>
+#include <set>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+static int checkMesh (const int* indices, size_t num_indices, size_t num_vertices, int levels)
+{
+	if (indices == NULL || num_indices == 0 || num_indices % POLY_SIZE != 0 || levels < 0)
+		return SUBDIV_ERROR_INVALID_ARGUMENT;
+
+	for (size_t i=0; i<num_indices; ++i)
+		if (indices[i] < 0 || (size_t)indices[i] >= num_vertices)
+			return SUBDIV_ERROR_INVALID_ARGUMENT;
+
+	// The half-edge mesh needs every edge shared by exactly two
+	// consistently oriented faces: each directed edge must appear once and
+	// its reverse must appear too. Every vertex must also be used, and the
+	// faces around it must form a single fan. Open, non-manifold, flipped
+	// or pinched input would otherwise be followed through unset links.
+	try
+	{
+		// Each directed edge a->b with the vertex before a in its face, which
+		// is where the fan around a continues.
+		typedef std::tuple<int,int,int> Edge;
+		std::vector<Edge> edges;
+		edges.reserve (num_indices);
+		for (size_t i=0; i<num_indices; ++i)
+		{
+			size_t first = i - i % POLY_SIZE;
+			int a = indices[i];
+			int b = indices[first + (i - first + 1) % POLY_SIZE];
+			int before = indices[first + (i - first + POLY_SIZE - 1) % POLY_SIZE];
+			if (a == b)
+				return SUBDIV_ERROR_INVALID_ARGUMENT;
+			edges.push_back (std::make_tuple (a, b, before));
+		}
+		std::sort (edges.begin(), edges.end());
+
+		auto find = [&](int a, int b)
+		{
+			auto it = std::lower_bound (edges.begin(), edges.end(), std::make_tuple (a, b, -1));
+			return (it != edges.end() && std::get<0> (*it) == a && std::get<1> (*it) == b) ? it : edges.end();
+		};
+
+		for (size_t i=0; i<edges.size(); ++i)
+		{
+			int a = std::get<0> (edges[i]), b = std::get<1> (edges[i]);
+			if (i+1 < edges.size() && std::get<0> (edges[i+1]) == a && std::get<1> (edges[i+1]) == b)
+				return SUBDIV_ERROR_INVALID_ARGUMENT;
+			if (find (b, a) == edges.end())
+				return SUBDIV_ERROR_INVALID_ARGUMENT;
+		}
+
+		// Outgoing edges of a vertex are contiguous once sorted; walking the
+		// fan from the first must visit all of them before coming back.
+		size_t start = 0;
+		for (size_t v=0; v<num_vertices; ++v)
+		{
+			size_t end = start;
+			while (end < edges.size() && std::get<0> (edges[end]) == (int)v)
+				++end;
+			if (end == start)
+				return SUBDIV_ERROR_INVALID_ARGUMENT;
+
+			size_t steps = 0;
+			auto it = edges.begin() + start;
+			do{
+				it = find ((int)v, std::get<2> (*it));
+				++steps;
+			} while (it != edges.begin() + start && steps <= end - start);
+			if (steps != end - start)
+				return SUBDIV_ERROR_INVALID_ARGUMENT;
+
+			start = end;
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		return SUBDIV_ERROR_INTERNAL;
+	}
+
+	return SUBDIV_OK;
+}
+
+static bool toScheme (subdiv_scheme in, SubdivisionScheme& out)
+{
+	switch (in)
+	{
+		case SUBDIV_LOOP: out = LOOP; return true;
+		case SUBDIV_BUTTERFLY: out = BUTTERFLY; return true;
+		case SUBDIV_SQRT3: out = SQRT3; return true;
+	}
+	return false;
+}
+
+extern "C" int subdiv_query_size (
+		const int* indices,
+		size_t num_indices,
+		size_t num_vertices,
+		subdiv_scheme scheme,
+		int levels,
+		size_t* out_num_vertices,
+		size_t* out_num_indices
+)
+{
+	SubdivisionScheme s;
+	if (!toScheme (scheme, s) || out_num_vertices == NULL || out_num_indices == NULL)
+		return SUBDIV_ERROR_INVALID_ARGUMENT;
+
+	int status = checkMesh (indices, num_indices, num_vertices, levels);
+	if (status != SUBDIV_OK)
+		return status;
+
+	try
+	{
+		std::set<std::pair<int,int> > edges;
+		for (size_t i=0; i<num_indices; ++i)
+		{
+			int a = indices[i];
+			int b = indices[(i % POLY_SIZE == POLY_SIZE-1) ? i+1-POLY_SIZE : i+1];
+			edges.insert (std::make_pair (std::min(a,b), std::max(a,b)));
+		}
+
+		size_t v = num_vertices;
+		size_t e = edges.size();
+		size_t f = num_indices / POLY_SIZE;
+		for (int l=0; l<levels; ++l)
+		{
+			if (s == SQRT3)
+			{
+				// One vertex per face, three spokes per face, old edges flipped.
+				v += f;
+				e += 3*f;
+				f *= 3;
+			}
+			else
+			{
+				// Loop and butterfly split every edge once and every face into four.
+				v += e;
+				e = 2*e + 3*f;
+				f *= 4;
+			}
+		}
+
+		*out_num_vertices = v;
+		*out_num_indices = f * POLY_SIZE;
+	}
+	catch (const std::bad_alloc&)
+	{
+		return SUBDIV_ERROR_INTERNAL;
+	}
+
+	return SUBDIV_OK;
+}
+
+extern "C" int subdiv_refine_within (
+		const float* positions,
+		size_t num_vertices,
+		const int* indices,
+		size_t num_indices,
+		subdiv_scheme scheme,
+		int levels,
+		double budget_seconds,
+		subdiv_progress_fn progress,
+		void* user_data,
+		float* out_positions,
+		size_t out_num_vertices,
+		int* out_indices,
+		size_t out_num_indices,
+		int* out_levels,
+		size_t* out_written_vertices,
+		size_t* out_written_indices
+)
+{
+	SubdivisionScheme s;
+	if (!toScheme (scheme, s) || positions == NULL || out_positions == NULL || out_indices == NULL)
+		return SUBDIV_ERROR_INVALID_ARGUMENT;
+
+	int status = checkMesh (indices, num_indices, num_vertices, levels);
+	if (status != SUBDIV_OK)
+		return status;
+
+	try
+	{
+		ExecutionContext context;
+		if (budget_seconds > 0)
+			context.setBudget (budget_seconds);
+		if (progress != NULL)
+			context.setProgressCallback ([&](const char* phase, double fraction)
+			{
+				if (progress (phase, fraction, user_data) != 0)
+					context.cancel();
+			});
+
+		StandardMesh mesh;
+		if (budget_seconds > 0 || progress != NULL)
+			mesh.context = &context;
+		mesh.generateMesh (positions, num_vertices, indices, num_indices);
+		int done = mesh.subdivideWithin (s, levels);
+
+		if (mesh.vertices.size() > out_num_vertices || mesh.faces.size()*POLY_SIZE > out_num_indices)
+			return SUBDIV_ERROR_BUFFER_TOO_SMALL;
+
+		mesh.exportMesh (out_positions, out_indices);
+		if (out_levels != NULL)
+			*out_levels = done;
+		if (out_written_vertices != NULL)
+			*out_written_vertices = mesh.vertices.size();
+		if (out_written_indices != NULL)
+			*out_written_indices = mesh.faces.size()*POLY_SIZE;
+
+		return (done < levels) ? SUBDIV_STOPPED : SUBDIV_OK;
+	}
+	catch (...)
+	{
+		return SUBDIV_ERROR_INTERNAL;
+	}
+}
+
+extern "C" int subdiv_refine (
+		const float* positions,
+		size_t num_vertices,
+		const int* indices,
+		size_t num_indices,
+		subdiv_scheme scheme,
+		int levels,
+		float* out_positions,
+		size_t out_num_vertices,
+		int* out_indices,
+		size_t out_num_indices
+)
+{
+	return subdiv_refine_within (positions, num_vertices, indices, num_indices, scheme, levels, 0, NULL, NULL,
+			out_positions, out_num_vertices, out_indices, out_num_indices, NULL, NULL, NULL);
+}
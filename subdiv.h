@@ -0,0 +1,118 @@
+#ifndef SUBDIV_H_
+#define SUBDIV_H_
+
+/*
+ * C interface to the subdivision library (libsubdiv).
+ *
+ * Meshes are passed as caller-owned arrays: positions holds packed xyz
+ * floats, indices holds three zero-based vertex indices per triangle.
+ * Input meshes must be closed, consistently oriented triangle meshes:
+ * every edge is shared by exactly two faces that traverse it in opposite
+ * directions, every vertex is used by some face, and the faces around each
+ * vertex form a single fan. Other input is rejected with
+ * SUBDIV_ERROR_INVALID_ARGUMENT.
+ *
+ * Typical use:
+ *
+ *     size_t nv, ni;
+ *     subdiv_query_size (indices, num_indices, num_vertices, SUBDIV_LOOP, 2, &nv, &ni);
+ *     float* out_pos = malloc (3*nv*sizeof(float));
+ *     int* out_idx = malloc (ni*sizeof(int));
+ *     subdiv_refine (positions, num_vertices, indices, num_indices,
+ *                    SUBDIV_LOOP, 2, out_pos, nv, out_idx, ni);
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum
+{
+	SUBDIV_LOOP = 0,
+	SUBDIV_BUTTERFLY = 1,
+	SUBDIV_SQRT3 = 2
+} subdiv_scheme;
+
+enum
+{
+	SUBDIV_OK = 0,
+	SUBDIV_STOPPED = 1,
+	SUBDIV_ERROR_INVALID_ARGUMENT = -1,
+	SUBDIV_ERROR_BUFFER_TOO_SMALL = -2,
+	SUBDIV_ERROR_INTERNAL = -3
+};
+
+/*
+ * Computes the number of vertices and indices produced by refining the
+ * given triangle mesh `levels` times. Only the connectivity is needed.
+ */
+int subdiv_query_size (
+		const int* indices,
+		size_t num_indices,
+		size_t num_vertices,
+		subdiv_scheme scheme,
+		int levels,
+		size_t* out_num_vertices,
+		size_t* out_num_indices
+);
+
+/*
+ * Refines the mesh `levels` times and writes the result into the output
+ * buffers. out_positions must hold 3*out_num_vertices floats and
+ * out_indices out_num_indices ints, as reported by subdiv_query_size.
+ */
+int subdiv_refine (
+		const float* positions,
+		size_t num_vertices,
+		const int* indices,
+		size_t num_indices,
+		subdiv_scheme scheme,
+		int levels,
+		float* out_positions,
+		size_t out_num_vertices,
+		int* out_indices,
+		size_t out_num_indices
+);
+
+/*
+ * Progress callback of subdiv_refine_within: receives the name of the
+ * running phase and its completed fraction. Returning non-zero cancels the
+ * refinement.
+ */
+typedef int (*subdiv_progress_fn) (const char* phase, double fraction, void* user_data);
+
+/*
+ * Like subdiv_refine, but stops early at the finest level that fits in
+ * budget_seconds (no limit when <= 0) or when progress asks to cancel.
+ * progress may be NULL. Output buffers are sized for `levels` as with
+ * subdiv_refine. The level reached and the number of vertices and indices
+ * written are stored in out_levels, out_written_vertices and
+ * out_written_indices. Returns SUBDIV_STOPPED when fewer than `levels`
+ * levels were done; the outputs then hold the last completed level.
+ */
+int subdiv_refine_within (
+		const float* positions,
+		size_t num_vertices,
+		const int* indices,
+		size_t num_indices,
+		subdiv_scheme scheme,
+		int levels,
+		double budget_seconds,
+		subdiv_progress_fn progress,
+		void* user_data,
+		float* out_positions,
+		size_t out_num_vertices,
+		int* out_indices,
+		size_t out_num_indices,
+		int* out_levels,
+		size_t* out_written_vertices,
+		size_t* out_written_indices
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
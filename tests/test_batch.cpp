@@ -0,0 +1,68 @@
+#include "testmesh.hpp"
+#include "../batch.hpp"
+
+// Replaying the recorded stencils of a FrameBatch gives, for every frame,
+// what refining that frame through Mesh::subdivide gives.
+
+int main ()
+{
+	const int levels = 3;
+	const size_t num_frames = 3;
+
+	std::vector<Vector3f> coarse;
+	std::vector<int> indices;
+	torus (6, 4, coarse, indices);
+
+	std::vector<std::vector<Vector3f> > frames (num_frames, coarse);
+	for (size_t f=1; f<num_frames; ++f)
+		for (size_t v=0; v<coarse.size(); ++v)
+			frames[f][v] = Vector3f (coarse[v][0]*(1+f), coarse[v][1] - f, coarse[v][2] + 0.1f*v);
+
+	const SubdivisionScheme schemes[] = {LOOP, BUTTERFLY, SQRT3};
+	for (SubdivisionScheme scheme : schemes)
+	{
+		std::vector<float> packed = packPositions (coarse);
+		StandardMesh mesh;
+		mesh.generateMesh (packed.data(), coarse.size(), indices.data(), indices.size());
+
+		FrameBatch batch (num_frames);
+		check (batch.refine (mesh, scheme, levels) == 0, std::string (schemeName (scheme)) + ": refine succeeds");
+		for (size_t f=0; f<num_frames; ++f)
+			check (batch.setFrame (f, frames[f]) == 0, std::string (schemeName (scheme)) + ": frame is accepted");
+		batch.evaluate();
+
+		std::vector<int> refined_indices (mesh.faces.size()*POLY_SIZE);
+		mesh.exportIndices (refined_indices.data());
+
+		for (size_t f=0; f<num_frames; ++f)
+		{
+			std::string name = std::string (schemeName (scheme)) + " frame " + std::to_string (f);
+			std::vector<float> expected_positions, positions;
+			std::vector<int> expected_indices;
+			refineGlobal (frames[f], indices, scheme, levels, expected_positions, expected_indices);
+			batch.getFrame (f, positions);
+
+			check (refined_indices == expected_indices, name + ": faces match");
+			bool close = positions.size() == expected_positions.size();
+			for (size_t i=0; close && i<positions.size(); ++i)
+				close = std::fabs (positions[i] - expected_positions[i]) <= 1e-4f * std::max (1.f, std::fabs (expected_positions[i]));
+			check (close, name + ": positions match");
+		}
+	}
+
+	FrameBatch batch (2);
+	std::vector<float> packed = packPositions (coarse);
+	StandardMesh mesh;
+	mesh.generateMesh (packed.data(), coarse.size(), indices.data(), indices.size());
+	batch.refine (mesh, LOOP, 1);
+	std::vector<Vector3f> short_frame (coarse.begin(), coarse.end() - 1);
+	check (batch.setFrame (1, short_frame) < 0, "frame with a different vertex count is rejected");
+	check (batch.setFrame (2, coarse) < 0, "frame index out of range is rejected");
+
+	ExecutionContext context;
+	context.cancel();
+	mesh.context = &context;
+	check (batch.refine (mesh, LOOP, 1) < 0, "stopped refinement is reported");
+
+	return report ("test_batch");
+}
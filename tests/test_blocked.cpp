@@ -0,0 +1,41 @@
+#include "testmesh.hpp"
+#include "../blocked.hpp"
+
+// Cache-blocked refinement gives the mesh of global refinement, whatever
+// the cluster size: from one cluster for the whole mesh down to the
+// smallest clusters, whose trimmed halos are the tightest.
+
+int main ()
+{
+	std::vector<Vector3f> ico_positions, torus_positions;
+	std::vector<int> ico_indices, torus_indices;
+	icosahedron (ico_positions, ico_indices);
+	torus (8, 6, torus_positions, torus_indices);
+
+	struct Case { const char* name; const std::vector<Vector3f>* positions; const std::vector<int>* indices; };
+	const Case cases[] = {{"icosahedron", &ico_positions, &ico_indices}, {"torus", &torus_positions, &torus_indices}};
+	const SubdivisionScheme schemes[] = {LOOP, BUTTERFLY};
+	const size_t cache_sizes[] = {1, 64 << 10, (size_t)1 << 30};
+
+	for (const Case& c : cases)
+		for (SubdivisionScheme scheme : schemes)
+			for (int levels=1; levels<=3; ++levels)
+			{
+				std::vector<float> expected_positions;
+				std::vector<int> expected_indices;
+				refineGlobal (*c.positions, *c.indices, scheme, levels, expected_positions, expected_indices);
+
+				for (size_t cache_bytes : cache_sizes)
+				{
+					std::string name = std::string (c.name) + " " + schemeName (scheme) + " level " + std::to_string (levels)
+						+ " cache " + std::to_string (cache_bytes);
+					std::vector<float> positions;
+					std::vector<int> indices;
+					BlockedRefiner refiner (*c.positions, *c.indices, scheme, levels);
+					check (refiner.run (positions, indices, cache_bytes) == 0, name + ": run succeeds");
+					check (sameMesh (positions, indices, expected_positions, expected_indices, 1e-5f), name + ": matches global refinement");
+				}
+			}
+
+	return report ("test_blocked");
+}
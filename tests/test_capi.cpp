@@ -0,0 +1,83 @@
+#include "testmesh.hpp"
+#include "../subdiv.h"
+
+// The C API against Mesh::subdivide, and its rejection of meshes the
+// half-edge structure cannot represent.
+
+static subdiv_scheme toC (SubdivisionScheme scheme)
+{
+	switch (scheme)
+	{
+		case LOOP: return SUBDIV_LOOP;
+		case BUTTERFLY: return SUBDIV_BUTTERFLY;
+		case SQRT3: return SUBDIV_SQRT3;
+	}
+	return SUBDIV_LOOP;
+}
+
+static int refineC (
+		const std::vector<Vector3f>& positions,
+		const std::vector<int>& indices,
+		SubdivisionScheme scheme,
+		int levels,
+		std::vector<float>& out_positions,
+		std::vector<int>& out_indices
+)
+{
+	size_t num_vertices = 0, num_indices = 0;
+	int status = subdiv_query_size (indices.data(), indices.size(), positions.size(), toC (scheme), levels, &num_vertices, &num_indices);
+	if (status != SUBDIV_OK)
+		return status;
+
+	std::vector<float> packed = packPositions (positions);
+	out_positions.assign (3*num_vertices, 0.f);
+	out_indices.assign (num_indices, -1);
+	return subdiv_refine (packed.data(), positions.size(), indices.data(), indices.size(), toC (scheme), levels,
+			out_positions.data(), num_vertices, out_indices.data(), num_indices);
+}
+
+int main ()
+{
+	std::vector<Vector3f> positions;
+	std::vector<int> indices;
+	icosahedron (positions, indices);
+
+	const SubdivisionScheme schemes[] = {LOOP, BUTTERFLY, SQRT3};
+	for (SubdivisionScheme scheme : schemes)
+		for (int levels=0; levels<=3; ++levels)
+		{
+			std::string name = std::string (schemeName (scheme)) + " level " + std::to_string (levels);
+			std::vector<float> expected_positions, out_positions;
+			std::vector<int> expected_indices, out_indices;
+			refineGlobal (positions, indices, scheme, levels, expected_positions, expected_indices);
+			check (refineC (positions, indices, scheme, levels, out_positions, out_indices) == SUBDIV_OK, name + ": subdiv_refine succeeds");
+			check (out_positions == expected_positions && out_indices == expected_indices, name + ": matches Mesh::subdivide");
+		}
+
+	std::vector<float> out_positions;
+	std::vector<int> out_indices;
+
+	std::vector<int> open (indices.begin(), indices.end() - POLY_SIZE);
+	check (refineC (positions, open, LOOP, 1, out_positions, out_indices) == SUBDIV_ERROR_INVALID_ARGUMENT, "open mesh is rejected");
+
+	std::vector<int> fan = {0, 1, 2, 0, 1, 3, 0, 1, 4};
+	check (refineC (positions, fan, LOOP, 1, out_positions, out_indices) == SUBDIV_ERROR_INVALID_ARGUMENT, "edge of three faces is rejected");
+
+	std::vector<int> out_of_range = indices;
+	out_of_range[7] = positions.size();
+	check (refineC (positions, out_of_range, LOOP, 1, out_positions, out_indices) == SUBDIV_ERROR_INVALID_ARGUMENT, "index out of range is rejected");
+
+	std::vector<Vector3f> tetra_positions = {
+		Vector3f (0, 0, 0), Vector3f (1, 0, 0), Vector3f (0, 1, 0), Vector3f (0, 0, 1),
+		Vector3f (-1, 0, 0), Vector3f (0, -1, 0), Vector3f (0, 0, -1)
+	};
+	std::vector<int> tetra = {0,2,1, 0,1,3, 0,3,2, 1,2,3};
+	std::vector<Vector3f> unreferenced (tetra_positions.begin(), tetra_positions.begin() + 5);
+	check (refineC (unreferenced, tetra, LOOP, 1, out_positions, out_indices) == SUBDIV_ERROR_INVALID_ARGUMENT, "unreferenced vertex is rejected");
+
+	std::vector<int> pinched = tetra;
+	pinched.insert (pinched.end(), {0,5,4, 0,4,6, 0,6,5, 4,5,6});
+	check (refineC (tetra_positions, pinched, LOOP, 1, out_positions, out_indices) == SUBDIV_ERROR_INVALID_ARGUMENT, "two tetrahedra sharing a vertex are rejected");
+
+	return report ("test_capi");
+}
@@ -0,0 +1,60 @@
+#include "testmesh.hpp"
+
+// Open meshes load and export unchanged, with boundary-aware one-rings,
+// and subdivision refuses meshes its rules cannot handle.
+
+static void build (StandardMesh& mesh, const std::vector<Vector3f>& positions, const std::vector<int>& indices)
+{
+	std::vector<float> packed = packPositions (positions);
+	mesh.generateMesh (packed.data(), positions.size(), indices.data(), indices.size());
+}
+
+static std::vector<int> ring (const OneRingTable& table, int v)
+{
+	return std::vector<int> (table.begin (v), table.end (v));
+}
+
+int main ()
+{
+	std::vector<Vector3f> square = {Vector3f (0, 0, 0), Vector3f (1, 0, 0), Vector3f (1, 1, 0), Vector3f (0, 1, 0), Vector3f (5, 5, 5)};
+	std::vector<int> square_indices = {0, 1, 2, 0, 2, 3};
+
+	StandardMesh open;
+	build (open, square, square_indices);
+	std::vector<float> positions (3*open.vertices.size());
+	std::vector<int> indices (POLY_SIZE*open.faces.size());
+	open.exportMesh (positions.data(), indices.data());
+	check (positions == packPositions (square) && indices == square_indices, "open mesh exports unchanged");
+
+	const OneRingTable& table = open.oneRing();
+	check (ring (table, 0) == std::vector<int> ({1, 2, 3}), "interior fan of a boundary vertex");
+	check (ring (table, 1) == std::vector<int> ({2, 0}), "corner of a boundary");
+	check (ring (table, 4).empty(), "unreferenced vertex has an empty ring");
+	check (open.subdivide (LOOP) < 0, "open mesh is refused");
+
+	std::vector<Vector3f> ico_positions;
+	std::vector<int> ico_indices;
+	icosahedron (ico_positions, ico_indices);
+
+	StandardMesh closed;
+	build (closed, ico_positions, ico_indices);
+	check (closed.isClosedManifold() && closed.subdivide (LOOP) == 0, "closed mesh subdivides");
+
+	std::vector<Vector3f> extra = ico_positions;
+	extra.push_back (Vector3f (9, 9, 9));
+	StandardMesh unreferenced;
+	build (unreferenced, extra, ico_indices);
+	check (unreferenced.subdivide (LOOP) < 0, "unreferenced vertex is refused");
+
+	// Two tetrahedra sharing vertex 0.
+	std::vector<Vector3f> tetra_positions = {
+		Vector3f (0, 0, 0), Vector3f (1, 0, 0), Vector3f (0, 1, 0), Vector3f (0, 0, 1),
+		Vector3f (-1, 0, 0), Vector3f (0, -1, 0), Vector3f (0, 0, -1)
+	};
+	std::vector<int> tetra_indices = {0,2,1, 0,1,3, 0,3,2, 1,2,3, 0,5,4, 0,4,6, 0,6,5, 4,5,6};
+	StandardMesh pinched;
+	build (pinched, tetra_positions, tetra_indices);
+	check (pinched.subdivide (LOOP) < 0, "non-manifold vertex is refused");
+
+	return report ("test_mesh");
+}
@@ -0,0 +1,63 @@
+#include "testmesh.hpp"
+#include "../patch.hpp"
+
+// Implicit per-face grids give the mesh of global refinement, including
+// around control vertices of valence above 64, and refuse control meshes
+// they cannot walk.
+
+int main ()
+{
+	std::vector<Vector3f> ico_positions, torus_positions, bipyramid_positions;
+	std::vector<int> ico_indices, torus_indices, bipyramid_indices;
+	icosahedron (ico_positions, ico_indices);
+	torus (8, 6, torus_positions, torus_indices);
+	bipyramid (70, bipyramid_positions, bipyramid_indices);
+
+	struct Case { const char* name; const std::vector<Vector3f>* positions; const std::vector<int>* indices; int levels; };
+	const Case cases[] = {
+		{"icosahedron", &ico_positions, &ico_indices, 3},
+		{"torus", &torus_positions, &torus_indices, 3},
+		{"valence 70 bipyramid", &bipyramid_positions, &bipyramid_indices, 2}
+	};
+	const SubdivisionScheme schemes[] = {LOOP, BUTTERFLY};
+
+	for (const Case& c : cases)
+		for (SubdivisionScheme scheme : schemes)
+		{
+			PatchMesh patch_mesh (*c.positions, *c.indices, scheme);
+			for (int l=1; l<=c.levels; ++l)
+			{
+				std::string name = std::string (c.name) + " " + schemeName (scheme) + " level " + std::to_string (l);
+				check (patch_mesh.subdivide() == 0, name + ": subdivide succeeds");
+
+				std::vector<float> expected_positions, positions;
+				std::vector<int> expected_indices, indices;
+				refineGlobal (*c.positions, *c.indices, scheme, l, expected_positions, expected_indices);
+				patch_mesh.exportMesh (positions, indices);
+				check (sameMesh (positions, indices, expected_positions, expected_indices, 1e-5f), name + ": matches global refinement");
+			}
+		}
+
+	std::vector<int> open (ico_indices.begin(), ico_indices.end() - POLY_SIZE);
+	check (PatchMesh (ico_positions, open, LOOP).subdivide() < 0, "open cage is rejected");
+
+	std::vector<int> flipped = ico_indices;
+	std::swap (flipped[0], flipped[1]);
+	check (PatchMesh (ico_positions, flipped, LOOP).subdivide() < 0, "inconsistently oriented cage is rejected");
+
+	std::vector<Vector3f> extra = ico_positions;
+	extra.push_back (Vector3f (9, 9, 9));
+	check (PatchMesh (extra, ico_indices, LOOP).subdivide() < 0, "unreferenced cage vertex is rejected");
+
+	// Two tetrahedra sharing vertex 0.
+	std::vector<Vector3f> tetra_positions = {
+		Vector3f (0, 0, 0), Vector3f (1, 0, 0), Vector3f (0, 1, 0), Vector3f (0, 0, 1),
+		Vector3f (-1, 0, 0), Vector3f (0, -1, 0), Vector3f (0, 0, -1)
+	};
+	std::vector<int> pinched = {0,2,1, 0,1,3, 0,3,2, 1,2,3, 0,5,4, 0,4,6, 0,6,5, 4,5,6};
+	check (PatchMesh (tetra_positions, pinched, LOOP).subdivide() < 0, "cage vertex with two fans is rejected");
+
+	check (PatchMesh (ico_positions, ico_indices, SQRT3).subdivide() < 0, "sqrt3 is rejected");
+
+	return report ("test_patch");
+}
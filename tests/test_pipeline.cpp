@@ -0,0 +1,75 @@
+#include "testmesh.hpp"
+#include "../meshio.hpp"
+#include "../pipeline.hpp"
+
+#include <cstdio>
+#include <sstream>
+
+// The pipeline writes, byte for byte, what subdividing and writing each
+// mesh in turn writes, whether the vertex block was streamed during the
+// last level or not, and a failed job leaves the others intact.
+
+static std::string readFile (const char* path)
+{
+	std::ifstream fs (path, std::ifstream::in | std::ifstream::binary);
+	std::stringstream text;
+	text << fs.rdbuf();
+	return text.str();
+}
+
+int main ()
+{
+	const char* input = "test_pipeline.tmp.in.obj";
+	const char* open_input = "test_pipeline.tmp.open.obj";
+	const char* outputs[] = {"test_pipeline.tmp.out0.obj", "test_pipeline.tmp.out1.obj", "test_pipeline.tmp.out2.obj"};
+
+	std::vector<Vector3f> positions;
+	std::vector<int> indices;
+	icosahedron (positions, indices);
+	std::vector<float> packed = packPositions (positions);
+	{
+		std::ofstream fs (input, std::ofstream::out);
+		MeshIO<MeshFileType::OBJ>::writeMesh (fs, packed, indices);
+		std::ofstream open_fs (open_input, std::ofstream::out);
+		std::vector<int> open (indices.begin(), indices.end() - POLY_SIZE);
+		MeshIO<MeshFileType::OBJ>::writeMesh (open_fs, packed, open);
+	}
+
+	const SubdivisionScheme schemes[] = {LOOP, BUTTERFLY, SQRT3};
+	for (SubdivisionScheme scheme : schemes)
+		for (int levels=0; levels<=2; ++levels)
+		{
+			std::string name = std::string (schemeName (scheme)) + " level " + std::to_string (levels);
+
+			StandardMesh mesh;
+			MeshIO<MeshFileType::OBJ>::loadMesh (input, mesh);
+			for (int l=0; l<levels; ++l)
+				mesh.subdivide (scheme);
+			std::ostringstream expected;
+			MeshIO<MeshFileType::OBJ>::writeMesh (expected, mesh);
+
+			// Small chunks, so the sink runs while the vertex block streams.
+			std::vector<PipelineJob> jobs (3);
+			const char* inputs[] = {input, open_input, input};
+			for (size_t i=0; i<jobs.size(); ++i)
+			{
+				jobs[i].input = inputs[i];
+				jobs[i].output = outputs[i];
+			}
+			int status = runPipeline (jobs, scheme, levels, 1, 256, 2);
+
+			check (readFile (outputs[0]) == expected.str() && readFile (outputs[2]) == expected.str(), name + ": matches a direct write");
+			if (levels == 0)
+				check (status == 0, name + ": open mesh passes through unrefined");
+			else
+				check (status < 0 && jobs[1].status < 0 && jobs[0].status == 0 && jobs[2].status == 0, name + ": only the open job fails");
+
+			for (const char* output : outputs)
+				std::remove (output);
+		}
+
+	std::remove (input);
+	std::remove (open_input);
+
+	return report ("test_pipeline");
+}
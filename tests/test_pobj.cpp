@@ -0,0 +1,57 @@
+#include "testmesh.hpp"
+#include "../meshio.hpp"
+
+#include <cstdio>
+
+// Every level of a progressive OBJ reloads as the mesh that was written.
+
+int main ()
+{
+	const char* path = "test_pobj.tmp.obj";
+	const int levels = 3;
+
+	std::vector<Vector3f> positions;
+	std::vector<int> indices;
+	torus (6, 4, positions, indices);
+
+	const SubdivisionScheme schemes[] = {LOOP, BUTTERFLY, SQRT3};
+	for (SubdivisionScheme scheme : schemes)
+	{
+		std::vector<float> packed = packPositions (positions);
+		StandardMesh mesh;
+		mesh.generateMesh (packed.data(), positions.size(), indices.data(), indices.size());
+
+		std::ofstream fs (path, std::ofstream::out);
+		size_t num_written = 0;
+		MeshIO<MeshFileType::POBJ>::writeLevel (fs, mesh, 0, scheme, num_written);
+		for (int l=1; l<=levels; ++l)
+		{
+			mesh.subdivide (scheme);
+			MeshIO<MeshFileType::POBJ>::writeLevel (fs, mesh, l, scheme, num_written);
+		}
+		fs.close();
+
+		for (int l=0; l<=levels; ++l)
+		{
+			std::string name = std::string (schemeName (scheme)) + " level " + std::to_string (l);
+			std::vector<float> expected_positions;
+			std::vector<int> expected_indices;
+			refineGlobal (positions, indices, scheme, l, expected_positions, expected_indices);
+
+			std::vector<Vector3f> loaded;
+			std::vector<int> loaded_indices;
+			check (MeshIO<MeshFileType::POBJ>::loadMesh (path, loaded, loaded_indices, l) == l, name + ": level is found");
+			check (loaded_indices == expected_indices, name + ": faces match");
+
+			// Positions are written with six significant digits.
+			std::vector<float> loaded_positions = packPositions (loaded);
+			bool close = loaded_positions.size() == expected_positions.size();
+			for (size_t i=0; close && i<loaded_positions.size(); ++i)
+				close = std::fabs (loaded_positions[i] - expected_positions[i]) <= 1e-5f;
+			check (close, name + ": positions match");
+		}
+	}
+
+	std::remove (path);
+	return report ("test_pobj");
+}
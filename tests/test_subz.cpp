@@ -0,0 +1,114 @@
+#include "testmesh.hpp"
+#include "../meshio.hpp"
+
+#include <cstring>
+
+// SUBZ round trips within the quantisation step, and corrupt or truncated
+// input is rejected before anything is sized from its header.
+
+typedef MeshIO<MeshFileType::SUBZ> SubzIO;
+
+static std::vector<Vector3f> unpack (const std::vector<float>& packed)
+{
+	std::vector<Vector3f> positions;
+	for (size_t i=0; i+2<packed.size(); i+=3)
+		positions.push_back (Vector3f (packed[i], packed[i+1], packed[i+2]));
+	return positions;
+}
+
+static int decode (const std::vector<uint8_t>& data, std::vector<Vector3f>& positions, std::vector<int>& indices)
+{
+	positions.clear();
+	indices.clear();
+	return SubzIO::decode (data.data(), data.size(), positions, indices);
+}
+
+static void putU32 (std::vector<uint8_t>& data, size_t at, uint32_t value)
+{
+	memcpy (&data[at], &value, 4);
+}
+
+int main ()
+{
+	std::vector<Vector3f> ico_positions, torus_positions;
+	std::vector<int> ico_indices, torus_indices;
+	icosahedron (ico_positions, ico_indices);
+	torus (8, 6, torus_positions, torus_indices);
+
+	struct Case { const char* name; const std::vector<Vector3f>* positions; const std::vector<int>* indices; };
+	const Case cases[] = {{"icosahedron", &ico_positions, &ico_indices}, {"torus", &torus_positions, &torus_indices}};
+	const int bit_counts[] = {12, 16, 24};
+
+	std::vector<uint8_t> reference;
+	for (const Case& c : cases)
+		for (int levels=0; levels<=2; ++levels)
+		{
+			std::vector<float> refined_positions;
+			std::vector<int> refined_indices;
+			refineGlobal (*c.positions, *c.indices, LOOP, levels, refined_positions, refined_indices);
+			std::vector<Vector3f> refined = unpack (refined_positions);
+
+			for (int bits : bit_counts)
+			{
+				std::string name = std::string (c.name) + " level " + std::to_string (levels) + " " + std::to_string (bits) + " bits";
+				std::vector<uint8_t> data;
+				check (SubzIO::encode (refined, refined_indices, bits, data) == 0, name + ": encodes");
+
+				std::vector<Vector3f> decoded;
+				std::vector<int> decoded_indices;
+				check (decode (data, decoded, decoded_indices) == 0, name + ": decodes");
+
+				// A quantisation step of the widest possible axis, plus rounding.
+				float extent = 0;
+				for (size_t i=0; i<refined_positions.size(); ++i)
+					extent = std::max (extent, std::fabs (refined_positions[i]));
+				float tol = 2*extent / ((1u << bits) - 1) + 1e-6f;
+				check (sameMesh (packPositions (decoded), decoded_indices, refined_positions, refined_indices, tol), name + ": round trips");
+
+				reference = data;
+			}
+		}
+
+	std::vector<Vector3f> positions;
+	std::vector<int> indices;
+	const size_t header = 38;
+
+	std::vector<uint8_t> data = reference;
+	data[0] = 'X';
+	check (decode (data, positions, indices) < 0, "bad magic is rejected");
+
+	data = reference;
+	data.resize (header + (data.size() - header)/2);
+	check (decode (data, positions, indices) < 0, "truncated payload is rejected");
+
+	data.assign (reference.begin(), reference.begin() + header - 1);
+	check (decode (data, positions, indices) < 0, "truncated header is rejected");
+
+	data = reference;
+	putU32 (data, 4, 0xFFFFFFF0u);
+	check (decode (data, positions, indices) < 0, "forged vertex count is rejected");
+
+	data = reference;
+	putU32 (data, 8, 0xFFFFFFF0u);
+	check (decode (data, positions, indices) < 0, "forged face count is rejected");
+
+	// Flipped payload bytes either fail to decode or decode to positions
+	// inside the quantisation box, never to wrapped-around values.
+	float lo[3], extent[3];
+	memcpy (lo, &reference[14], sizeof(lo));
+	memcpy (extent, &reference[26], sizeof(extent));
+	bool inside = true;
+	for (size_t at=header; at<reference.size(); ++at)
+	{
+		data = reference;
+		data[at] ^= 0xFF;
+		if (decode (data, positions, indices) < 0)
+			continue;
+		for (const Vector3f& p : positions)
+			for (int c=0; c<3; ++c)
+				inside = inside && p[c] >= lo[c] - 1e-4f && p[c] <= lo[c] + extent[c] + 1e-4f;
+	}
+	check (inside, "corrupt residuals stay inside the quantisation box");
+
+	return report ("test_subz");
+}
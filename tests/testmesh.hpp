@@ -0,0 +1,171 @@
+#ifndef TESTMESH_HPP_
+#define TESTMESH_HPP_
+
+#include "../mesh.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Closed test meshes, the reference refinement and the comparisons shared
+// by the tests. Every test is one program that prints its failures and
+// returns non-zero if there were any.
+
+static int failures = 0;
+
+inline void check (bool ok, const std::string& what)
+{
+	if (ok) return;
+	std::cout << "FAILED: " << what << std::endl;
+	failures++;
+}
+
+inline int report (const char* test)
+{
+	if (failures == 0)
+		std::cout << test << ": ok" << std::endl;
+	return failures == 0 ? 0 : 1;
+}
+
+inline const char* schemeName (SubdivisionScheme scheme)
+{
+	switch (scheme)
+	{
+		case LOOP: return "loop";
+		case BUTTERFLY: return "butterfly";
+		case SQRT3: return "sqrt3";
+	}
+	return "?";
+}
+
+inline void icosahedron (std::vector<Vector3f>& positions, std::vector<int>& indices)
+{
+	const float t = (1.f + std::sqrt (5.f)) / 2.f;
+	positions = {
+		Vector3f (-1, t, 0), Vector3f (1, t, 0), Vector3f (-1, -t, 0), Vector3f (1, -t, 0),
+		Vector3f (0, -1, t), Vector3f (0, 1, t), Vector3f (0, -1, -t), Vector3f (0, 1, -t),
+		Vector3f (t, 0, -1), Vector3f (t, 0, 1), Vector3f (-t, 0, -1), Vector3f (-t, 0, 1)
+	};
+	indices = {
+		0,11,5, 0,5,1, 0,1,7, 0,7,10, 0,10,11, 1,5,9, 5,11,4, 11,10,2, 10,7,6, 7,1,8,
+		3,9,4, 3,4,2, 3,2,6, 3,6,8, 3,8,9, 4,9,5, 2,4,11, 6,2,10, 8,6,7, 9,8,1
+	};
+}
+
+// Genus one, every vertex of valence six.
+inline void torus (int rings, int segments, std::vector<Vector3f>& positions, std::vector<int>& indices)
+{
+	positions.clear();
+	indices.clear();
+	for (int i=0; i<rings; ++i)
+		for (int j=0; j<segments; ++j)
+		{
+			float u = 2*M_PI*i/rings, v = 2*M_PI*j/segments;
+			positions.push_back (Vector3f ((2 + 0.5f*std::cos (v))*std::cos (u), (2 + 0.5f*std::cos (v))*std::sin (u), 0.5f*std::sin (v)));
+		}
+	for (int i=0; i<rings; ++i)
+		for (int j=0; j<segments; ++j)
+		{
+			int a = i*segments + j, b = ((i+1)%rings)*segments + j;
+			int c = ((i+1)%rings)*segments + (j+1)%segments, d = i*segments + (j+1)%segments;
+			indices.insert (indices.end(), {a, b, c, a, c, d});
+		}
+}
+
+// Two apices of valence n over a ring of n vertices.
+inline void bipyramid (int n, std::vector<Vector3f>& positions, std::vector<int>& indices)
+{
+	positions = {Vector3f (0, 0, 1), Vector3f (0, 0, -1)};
+	indices.clear();
+	for (int i=0; i<n; ++i)
+	{
+		positions.push_back (Vector3f (std::cos (2*M_PI*i/n), std::sin (2*M_PI*i/n), 0));
+		int a = 2 + i, b = 2 + (i+1)%n;
+		indices.insert (indices.end(), {0, a, b, 1, b, a});
+	}
+}
+
+inline std::vector<float> packPositions (const std::vector<Vector3f>& positions)
+{
+	std::vector<float> packed;
+	for (size_t v=0; v<positions.size(); ++v)
+		packed.insert (packed.end(), {positions[v][0], positions[v][1], positions[v][2]});
+	return packed;
+}
+
+// The half-edge Mesh, which every other refinement path has to match.
+inline void refineGlobal (
+		const std::vector<Vector3f>& positions,
+		const std::vector<int>& indices,
+		SubdivisionScheme scheme,
+		int levels,
+		std::vector<float>& out_positions,
+		std::vector<int>& out_indices
+)
+{
+	std::vector<float> packed = packPositions (positions);
+	StandardMesh mesh;
+	mesh.generateMesh (packed.data(), positions.size(), indices.data(), indices.size());
+	for (int l=0; l<levels; ++l)
+		mesh.subdivide (scheme);
+	out_positions.resize (3*mesh.vertices.size());
+	out_indices.resize (POLY_SIZE*mesh.faces.size());
+	mesh.exportMesh (out_positions.data(), out_indices.data());
+}
+
+// True if both meshes have the same oriented faces over the same positions,
+// up to tol per coordinate, whatever their vertex numbering and face order.
+inline bool sameMesh (
+		const std::vector<float>& positions_a,
+		const std::vector<int>& indices_a,
+		const std::vector<float>& positions_b,
+		const std::vector<int>& indices_b,
+		float tol
+)
+{
+	const size_t n = positions_a.size() / 3;
+	if (positions_b.size() != positions_a.size() || indices_b.size() != indices_a.size())
+		return false;
+
+	std::vector<int> to_b (n, -1);
+	std::vector<char> taken (n, 0);
+	for (size_t a=0; a<n; ++a)
+		for (size_t b=0; b<n && to_b[a] < 0; ++b)
+		{
+			if (taken[b]) continue;
+			bool close = true;
+			for (int c=0; c<3; ++c)
+				close = close && std::fabs (positions_a[3*a+c] - positions_b[3*b+c]) <= tol;
+			if (close)
+			{
+				to_b[a] = b;
+				taken[b] = 1;
+			}
+		}
+	if (std::find (to_b.begin(), to_b.end(), -1) != to_b.end())
+		return false;
+
+	// Faces as (smallest index first) rotations, so orientation counts.
+	struct Faces
+	{
+		static std::vector<std::vector<int> > canonical (const std::vector<int>& indices, const std::vector<int>* map)
+		{
+			std::vector<std::vector<int> > faces;
+			for (size_t f=0; f+POLY_SIZE<=indices.size(); f+=POLY_SIZE)
+			{
+				std::vector<int> face;
+				for (int c=0; c<POLY_SIZE; ++c)
+					face.push_back (map ? (*map)[indices[f+c]] : indices[f+c]);
+				std::rotate (face.begin(), std::min_element (face.begin(), face.end()), face.end());
+				faces.push_back (face);
+			}
+			std::sort (faces.begin(), faces.end());
+			return faces;
+		}
+	};
+	return Faces::canonical (indices_a, &to_b) == Faces::canonical (indices_b, NULL);
+}
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef WELD_HPP_
+#define WELD_HPP_
+
+#include "linalgebra.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+inline uint64_t weldCellKey (int64_t x, int64_t y, int64_t z)
+{
+	// 21 bits per axis; cells that alias share a bucket, which only costs
+	// extra distance tests, never a wrong merge.
+	const uint64_t mask = (1u << 21) - 1;
+	return ((uint64_t)x & mask) | (((uint64_t)y & mask) << 21) | (((uint64_t)z & mask) << 42);
+}
+
+// Merges vertices closer than tolerance and remaps indices to the
+// survivors, dropping faces that collapse. Vertices are bucketed in a
+// uniform grid with cells no smaller than the tolerance, so each vertex
+// only tests the 27 cells around it: O(n) expected. Bucketing and the
+// neighbour searches run in parallel.
+//
+// Every vertex is merged into the lowest-indexed vertex within tolerance,
+// and merges are followed transitively. Returns the number of vertices
+// removed.
+template <typename VertexVector, typename IndexVector>
+size_t weldVertices (
+		VertexVector& vertices,
+		IndexVector& indices,
+		float tolerance,
+		int poly_size = 3
+)
+{
+	const size_t n = vertices.size();
+	if (n == 0) return 0;
+
+	Vector3f lo = vertices[0], hi = vertices[0];
+	for (size_t i=1; i<n; ++i)
+		for (int c=0; c<3; ++c)
+		{
+			lo[c] = std::min (lo[c], vertices[i][c]);
+			hi[c] = std::max (hi[c], vertices[i][c]);
+		}
+	float cell = std::max (tolerance, 1e-6f * (hi - lo).norm());
+	if (cell <= 0) cell = 1;
+	const float inv_cell = 1 / cell;
+	const float tolerance2 = tolerance * tolerance;
+
+	std::vector<int64_t> coords (3*n);
+	parallelFor (n, [&](size_t begin, size_t end) {
+		for (size_t i=begin; i<end; ++i)
+			for (int c=0; c<3; ++c)
+				coords[3*i+c] = (int64_t)std::floor ((vertices[i][c] - lo[c]) * inv_cell);
+	});
+
+	// Cell buckets in compressed rows: cell_verts[cell_start[c], cell_start[c+1]).
+	std::unordered_map<uint64_t,int> cell_ids;
+	cell_ids.reserve (n);
+	std::vector<int> vert_cell (n);
+	std::vector<int> cell_start (1, 0);
+	for (size_t i=0; i<n; ++i)
+	{
+		auto ins = cell_ids.insert (std::make_pair (weldCellKey (coords[3*i], coords[3*i+1], coords[3*i+2]), (int)cell_start.size()-1));
+		if (ins.second) cell_start.push_back (0);
+		vert_cell[i] = ins.first->second;
+		cell_start[vert_cell[i]+1]++;
+	}
+	for (size_t c=1; c<cell_start.size(); ++c)
+		cell_start[c] += cell_start[c-1];
+	std::vector<int> cell_verts (n);
+	std::vector<int> fill (cell_start.begin(), cell_start.end()-1);
+	for (size_t i=0; i<n; ++i)
+		cell_verts[fill[vert_cell[i]]++] = i;
+
+	std::vector<int> rep (n);
+	parallelFor (n, [&](size_t begin, size_t end) {
+		for (size_t i=begin; i<end; ++i)
+		{
+			int best = i;
+			for (int dx=-1; dx<=1; ++dx)
+			for (int dy=-1; dy<=1; ++dy)
+			for (int dz=-1; dz<=1; ++dz)
+			{
+				auto found = cell_ids.find (weldCellKey (coords[3*i]+dx, coords[3*i+1]+dy, coords[3*i+2]+dz));
+				if (found == cell_ids.end()) continue;
+				for (int k=cell_start[found->second]; k<cell_start[found->second+1]; ++k)
+				{
+					int j = cell_verts[k];
+					if (j >= best) continue;
+					Vector3f d = vertices[j] - vertices[i];
+					if (d*d <= tolerance2) best = j;
+				}
+			}
+			rep[i] = best;
+		}
+	});
+
+	std::vector<int> remap (n);
+	VertexVector welded;
+	welded.reserve (n);
+	for (size_t i=0; i<n; ++i)
+	{
+		if (rep[i] == (int)i)
+		{
+			remap[i] = welded.size();
+			welded.push_back (vertices[i]);
+		}
+		else
+		{
+			rep[i] = rep[rep[i]];
+			remap[i] = remap[rep[i]];
+		}
+	}
+
+	IndexVector welded_indices;
+	welded_indices.reserve (indices.size());
+	for (size_t f=0; f+poly_size<=indices.size(); f+=poly_size)
+	{
+		bool degenerate = false;
+		for (int a=0; a<poly_size; ++a)
+			for (int b=a+1; b<poly_size; ++b)
+				if (remap[indices[f+a]] == remap[indices[f+b]]) degenerate = true;
+		if (degenerate) continue;
+		for (int a=0; a<poly_size; ++a)
+			welded_indices.push_back (remap[indices[f+a]]);
+	}
+
+	size_t removed = n - welded.size();
+	vertices.swap (welded);
+	indices.swap (welded_indices);
+	return removed;
+}
+
+#endif